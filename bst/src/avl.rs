@@ -0,0 +1,543 @@
+use std::cmp::Ordering;
+use std::mem;
+
+/// Index standing in for a missing child or parent.
+const NIL: u32 = u32::MAX;
+
+struct Node<K: Ord, D> {
+    key: K,
+    data: D,
+    left: u32,
+    right: u32,
+    parent: u32,
+    height: u8,
+    // number of nodes in the subtree rooted here, for rank and select.
+    size: u32
+}
+
+/// An AVL tree whose nodes live in one contiguous Vec and refer to each other by
+/// u32 index. Removal moves the last node into the freed slot so the arena
+/// never has holes. Equal keys are kept, the newer one to the right.
+pub struct AVL<K: Ord, D> {
+    nodes: Vec<Node<K, D>>,
+    root: u32
+}
+
+/// In order iterator over a contiguous stretch of an AVL tree.
+pub struct Iter<'a, K: Ord + 'a, D: 'a> {
+    tree: &'a AVL<K, D>,
+    cursor: u32,
+    stop: u32
+}
+
+impl<K: Ord, D> AVL<K, D> {
+    pub fn new() -> AVL<K, D> {
+        AVL { nodes: Vec::new(), root: NIL }
+    }
+
+    pub fn with_capacity(n: usize) -> AVL<K, D> {
+        AVL { nodes: Vec::with_capacity(n), root: NIL }
+    }
+
+    pub fn len(&self) -> usize {
+        self.nodes.len()
+    }
+
+    pub fn insert(&mut self, k: K, d: D) {
+        assert!(self.nodes.len() < NIL as usize, "AVL is full");
+
+        let mut parent = NIL;
+        let mut cursor = self.root;
+        let mut go_left = false;
+        while cursor != NIL {
+            parent = cursor;
+            go_left = k < self.nodes[cursor as usize].key;
+            cursor = if go_left { self.left(cursor) } else { self.right(cursor) };
+        }
+
+        let new = self.nodes.len() as u32;
+        self.nodes.push(Node { key: k, data: d, left: NIL, right: NIL,
+                               parent: parent, height: 1, size: 1 });
+        if parent == NIL {
+            self.root = new;
+        } else if go_left {
+            self.nodes[parent as usize].left = new;
+        } else {
+            self.nodes[parent as usize].right = new;
+        }
+        self.fix_upward(parent);
+    }
+
+    /// Remove one node with the given key and return its data.
+    pub fn remove(&mut self, target: &K) -> Option<D> {
+        let mut z = self.find(target);
+        if z == NIL {
+            return None;
+        }
+
+        // a node with two children trades places with its successor, which has
+        // at most one child.
+        if self.left(z) != NIL && self.right(z) != NIL {
+            let y = self.leftmost(self.right(z));
+            self.swap_payload(z, y);
+            z = y;
+        }
+
+        let child = if self.left(z) != NIL { self.left(z) } else { self.right(z) };
+        let parent = self.parent(z);
+        if child != NIL {
+            self.nodes[child as usize].parent = parent;
+        }
+        self.replace_child(parent, z, child);
+
+        let last = self.nodes.len() as u32 - 1;
+        let removed = self.nodes.swap_remove(z as usize);
+        if z != last {
+            self.relink(last, z);
+        }
+        self.fix_upward(if parent == last { z } else { parent });
+
+        Some(removed.data)
+    }
+
+    pub fn search(&self, target: &K) -> Option<&D> {
+        let i = self.find(target);
+        if i == NIL {
+            None
+        } else {
+            Some(&self.nodes[i as usize].data)
+        }
+    }
+
+    pub fn minimum(&self) -> Option<(&K, &D)> {
+        if self.root == NIL {
+            None
+        } else {
+            Some(self.entry(self.leftmost(self.root)))
+        }
+    }
+
+    pub fn maximum(&self) -> Option<(&K, &D)> {
+        if self.root == NIL {
+            None
+        } else {
+            let mut cursor = self.root;
+            while self.right(cursor) != NIL {
+                cursor = self.right(cursor);
+            }
+            Some(self.entry(cursor))
+        }
+    }
+
+    pub fn inorder<F>(&self, f: &mut F)
+        where F : FnMut((&K, &D)) {
+
+        for entry in self.iter() {
+            f(entry);
+        }
+    }
+
+    pub fn iter(&self) -> Iter<'_, K, D> {
+        let first = if self.root == NIL { NIL } else { self.leftmost(self.root) };
+        Iter { tree: self, cursor: first, stop: NIL }
+    }
+
+    /// Iterate in order starting at the first key not less than target.
+    pub fn lower_bound(&self, target: &K) -> Iter<'_, K, D> {
+        Iter { tree: self, cursor: self.lower_bound_index(target), stop: NIL }
+    }
+
+    /// Iterate in order starting at the first key greater than target.
+    pub fn upper_bound(&self, target: &K) -> Iter<'_, K, D> {
+        Iter { tree: self, cursor: self.upper_bound_index(target), stop: NIL }
+    }
+
+    /// Iterate in order over the keys in [low, high).
+    pub fn range(&self, low: &K, high: &K) -> Iter<'_, K, D> {
+        if high <= low {
+            return Iter { tree: self, cursor: NIL, stop: NIL };
+        }
+        Iter { tree: self,
+               cursor: self.lower_bound_index(low),
+               stop: self.lower_bound_index(high) }
+    }
+
+    /// The number of keys less than target.
+    pub fn rank(&self, target: &K) -> usize {
+        let mut count = 0;
+        let mut cursor = self.root;
+        while cursor != NIL {
+            if self.nodes[cursor as usize].key < *target {
+                count += self.size(self.left(cursor)) as usize + 1;
+                cursor = self.right(cursor);
+            } else {
+                cursor = self.left(cursor);
+            }
+        }
+        count
+    }
+
+    /// The i-th smallest entry, counting from 0.
+    pub fn select(&self, i: usize) -> Option<(&K, &D)> {
+        if i >= self.len() {
+            return None;
+        }
+        let mut i = i as u32;
+        let mut cursor = self.root;
+        loop {
+            let left_size = self.size(self.left(cursor));
+            if i < left_size {
+                cursor = self.left(cursor);
+            } else if i == left_size {
+                return Some(self.entry(cursor));
+            } else {
+                i -= left_size + 1;
+                cursor = self.right(cursor);
+            }
+        }
+    }
+
+    /// Check the ordering, balance, size and parent invariants.
+    #[cfg(test)]
+    fn verify(&self) -> bool {
+        fn recurse<K2: Ord, D2>(t: &AVL<K2, D2>, i: u32, parent: u32) -> Option<(u8, u32)> {
+            if i == NIL {
+                return Some((0, 0));
+            }
+            let n = &t.nodes[i as usize];
+            if n.parent != parent {
+                return None;
+            }
+            if n.left != NIL && t.nodes[n.left as usize].key > n.key {
+                return None;
+            }
+            if n.right != NIL && t.nodes[n.right as usize].key < n.key {
+                return None;
+            }
+            let (lh, ls) = recurse(t, n.left, i)?;
+            let (rh, rs) = recurse(t, n.right, i)?;
+            let h = lh.max(rh) + 1;
+            if (lh as i32 - rh as i32).abs() > 1 || n.height != h || n.size != ls + rs + 1 {
+                return None;
+            }
+            Some((h, n.size))
+        }
+        recurse(self, self.root, NIL).map_or(false, |(_, s)| s as usize == self.len())
+    }
+
+    fn find(&self, target: &K) -> u32 {
+        let mut cursor = self.root;
+        while cursor != NIL {
+            match target.cmp(&self.nodes[cursor as usize].key) {
+                Ordering::Equal => return cursor,
+                Ordering::Less => cursor = self.left(cursor),
+                Ordering::Greater => cursor = self.right(cursor)
+            }
+        }
+        NIL
+    }
+
+    fn lower_bound_index(&self, target: &K) -> u32 {
+        let mut best = NIL;
+        let mut cursor = self.root;
+        while cursor != NIL {
+            if self.nodes[cursor as usize].key >= *target {
+                best = cursor;
+                cursor = self.left(cursor);
+            } else {
+                cursor = self.right(cursor);
+            }
+        }
+        best
+    }
+
+    fn upper_bound_index(&self, target: &K) -> u32 {
+        let mut best = NIL;
+        let mut cursor = self.root;
+        while cursor != NIL {
+            if self.nodes[cursor as usize].key > *target {
+                best = cursor;
+                cursor = self.left(cursor);
+            } else {
+                cursor = self.right(cursor);
+            }
+        }
+        best
+    }
+
+    fn successor(&self, i: u32) -> u32 {
+        if self.right(i) != NIL {
+            return self.leftmost(self.right(i));
+        }
+        let mut child = i;
+        let mut cursor = self.parent(i);
+        while cursor != NIL && self.right(cursor) == child {
+            child = cursor;
+            cursor = self.parent(cursor);
+        }
+        cursor
+    }
+
+    fn leftmost(&self, i: u32) -> u32 {
+        let mut cursor = i;
+        while self.left(cursor) != NIL {
+            cursor = self.left(cursor);
+        }
+        cursor
+    }
+
+    fn entry(&self, i: u32) -> (&K, &D) {
+        let n = &self.nodes[i as usize];
+        (&n.key, &n.data)
+    }
+
+    fn left(&self, i: u32) -> u32 {
+        self.nodes[i as usize].left
+    }
+
+    fn right(&self, i: u32) -> u32 {
+        self.nodes[i as usize].right
+    }
+
+    fn parent(&self, i: u32) -> u32 {
+        self.nodes[i as usize].parent
+    }
+
+    fn height(&self, i: u32) -> u8 {
+        if i == NIL { 0 } else { self.nodes[i as usize].height }
+    }
+
+    fn size(&self, i: u32) -> u32 {
+        if i == NIL { 0 } else { self.nodes[i as usize].size }
+    }
+
+    // Recompute the height and size of a node from its children.
+    fn update(&mut self, i: u32) {
+        let (l, r) = (self.left(i), self.right(i));
+        let height = self.height(l).max(self.height(r)) + 1;
+        let size = self.size(l) + self.size(r) + 1;
+        let n = &mut self.nodes[i as usize];
+        n.height = height;
+        n.size = size;
+    }
+
+    // Point whatever referred to old as a child (a parent or the root) at new.
+    fn replace_child(&mut self, parent: u32, old: u32, new: u32) {
+        if parent == NIL {
+            self.root = new;
+        } else if self.left(parent) == old {
+            self.nodes[parent as usize].left = new;
+        } else {
+            self.nodes[parent as usize].right = new;
+        }
+    }
+
+    // The node at index to used to live at index from; repoint its neighbours.
+    fn relink(&mut self, from: u32, to: u32) {
+        let (parent, left, right) = {
+            let n = &self.nodes[to as usize];
+            (n.parent, n.left, n.right)
+        };
+        self.replace_child(parent, from, to);
+        if left != NIL {
+            self.nodes[left as usize].parent = to;
+        }
+        if right != NIL {
+            self.nodes[right as usize].parent = to;
+        }
+    }
+
+    fn swap_payload(&mut self, a: u32, b: u32) {
+        let (lo, hi) = if a < b { (a, b) } else { (b, a) };
+        let (first, second) = self.nodes.split_at_mut(hi as usize);
+        let (x, y) = (&mut first[lo as usize], &mut second[0]);
+        mem::swap(&mut x.key, &mut y.key);
+        mem::swap(&mut x.data, &mut y.data);
+    }
+
+    fn rotate_left(&mut self, x: u32) -> u32 {
+        let y = self.right(x);
+        let b = self.left(y);
+        let parent = self.parent(x);
+
+        self.nodes[x as usize].right = b;
+        if b != NIL {
+            self.nodes[b as usize].parent = x;
+        }
+        self.nodes[y as usize].parent = parent;
+        self.replace_child(parent, x, y);
+        self.nodes[y as usize].left = x;
+        self.nodes[x as usize].parent = y;
+
+        self.update(x);
+        self.update(y);
+        y
+    }
+
+    fn rotate_right(&mut self, x: u32) -> u32 {
+        let y = self.left(x);
+        let b = self.right(y);
+        let parent = self.parent(x);
+
+        self.nodes[x as usize].left = b;
+        if b != NIL {
+            self.nodes[b as usize].parent = x;
+        }
+        self.nodes[y as usize].parent = parent;
+        self.replace_child(parent, x, y);
+        self.nodes[y as usize].right = x;
+        self.nodes[x as usize].parent = y;
+
+        self.update(x);
+        self.update(y);
+        y
+    }
+
+    // Restore the AVL property at a node whose children are balanced, returning
+    // the root of the subtree afterwards.
+    fn rebalance(&mut self, i: u32) -> u32 {
+        let (l, r) = (self.left(i), self.right(i));
+        let balance = self.height(l) as i32 - self.height(r) as i32;
+        if balance > 1 {
+            if self.height(self.left(l)) < self.height(self.right(l)) {
+                self.rotate_left(l);
+            }
+            self.rotate_right(i)
+        } else if balance < -1 {
+            if self.height(self.right(r)) < self.height(self.left(r)) {
+                self.rotate_right(r);
+            }
+            self.rotate_left(i)
+        } else {
+            self.update(i);
+            i
+        }
+    }
+
+    // Rebalance and refresh sizes from a node up to the root.
+    // time: lg n
+    fn fix_upward(&mut self, i: u32) {
+        let mut cursor = i;
+        while cursor != NIL {
+            let top = self.rebalance(cursor);
+            cursor = self.parent(top);
+        }
+    }
+}
+
+impl<'a, K: Ord, D> Iterator for Iter<'a, K, D> {
+    type Item = (&'a K, &'a D);
+
+    fn next(&mut self) -> Option<(&'a K, &'a D)> {
+        if self.cursor == self.stop {
+            return None;
+        }
+        let i = self.cursor;
+        self.cursor = self.tree.successor(i);
+        Some(self.tree.entry(i))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::AVL;
+    use bench::{random_keys, Rng};
+
+    #[test]
+    fn test_insert10() {
+        let data = [3, 7, 2, 3, 7, 1, 4, 7, 11, 6];
+        let mut avl = AVL::new();
+        for &i in data.iter() {
+            avl.insert(i, i);
+        }
+        assert!(avl.verify());
+        assert_eq!(avl.minimum(), Some((&1, &1)));
+        assert_eq!(avl.maximum(), Some((&11, &11)));
+        for &i in data.iter() {
+            assert!(avl.search(&i).is_some());
+        }
+        assert!(avl.search(&69).is_none());
+    }
+
+    #[test]
+    fn test_empty() {
+        let avl: AVL<u8, u8> = AVL::new();
+        assert!(avl.minimum().is_none());
+        assert!(avl.maximum().is_none());
+        assert!(avl.search(&5).is_none());
+        assert!(avl.select(0).is_none());
+        assert_eq!(avl.iter().count(), 0);
+    }
+
+    #[test]
+    fn test_sorted_inserts_stay_balanced() {
+        let mut avl = AVL::new();
+        for i in 0..100_000u32 {
+            avl.insert(i, ());
+        }
+        assert!(avl.verify());
+        // an AVL tree of n nodes is at most about 1.44 lg n high.
+        assert!(avl.height(avl.root) <= 25);
+    }
+
+    #[test]
+    fn test_inorder() {
+        let mut avl = AVL::new();
+        for i in random_keys(1000, &mut Rng::new(7)) {
+            avl.insert(i, i);
+        }
+        let mut v = vec![];
+        avl.inorder(&mut |(&x, &_)| v.push(x));
+        assert_eq!(v, (0..1000).collect::<Vec<u64>>());
+    }
+
+    #[test]
+    fn test_remove() {
+        let mut avl = AVL::new();
+        for i in random_keys(1000, &mut Rng::new(3)) {
+            avl.insert(i, i * 2);
+        }
+        for i in random_keys(1000, &mut Rng::new(5)).into_iter().filter(|i| i % 3 != 0) {
+            assert_eq!(avl.remove(&i), Some(i * 2));
+            assert!(avl.search(&i).is_none());
+        }
+        assert!(avl.verify());
+        assert!(avl.remove(&1).is_none());
+
+        let keys: Vec<u64> = avl.iter().map(|(&k, _)| k).collect();
+        assert_eq!(keys, (0..1000).filter(|i| i % 3 == 0).collect::<Vec<u64>>());
+        for &k in keys.iter() {
+            assert_eq!(avl.search(&k), Some(&(k * 2)));
+        }
+    }
+
+    #[test]
+    fn test_bounds_and_range() {
+        let mut avl = AVL::new();
+        for i in random_keys(50, &mut Rng::new(11)) {
+            avl.insert(i * 2, ());
+        }
+        assert_eq!(avl.lower_bound(&10).next(), Some((&10, &())));
+        assert_eq!(avl.lower_bound(&11).next(), Some((&12, &())));
+        assert_eq!(avl.upper_bound(&10).next(), Some((&12, &())));
+        assert!(avl.lower_bound(&99).next().is_none());
+
+        let keys: Vec<u64> = avl.range(&7, &15).map(|(&k, _)| k).collect();
+        assert_eq!(keys, [8, 10, 12, 14]);
+        assert_eq!(avl.range(&15, &7).count(), 0);
+    }
+
+    #[test]
+    fn test_rank_select() {
+        let mut avl = AVL::new();
+        for i in random_keys(500, &mut Rng::new(13)) {
+            avl.insert(i * 10, i);
+        }
+        for i in 0..500 {
+            assert_eq!(avl.select(i as usize), Some((&(i * 10), &i)));
+            assert_eq!(avl.rank(&(i * 10)), i as usize);
+            assert_eq!(avl.rank(&(i * 10 + 1)), i as usize + 1);
+        }
+        assert!(avl.select(500).is_none());
+    }
+}
@@ -0,0 +1,213 @@
+use std::collections::BTreeMap;
+use std::hint::black_box;
+use std::time::Instant;
+
+use avl::AVL;
+use layout::{Eytzinger, STree};
+use BST;
+
+/// xorshift64*, so the benchmarks and tests don't need a rand dependency.
+pub struct Rng(u64);
+
+impl Rng {
+    pub fn new(seed: u64) -> Rng {
+        Rng(seed | 1)
+    }
+
+    pub fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545F4914F6CDD1D)
+    }
+
+    /// A uniform float in [0, 1).
+    pub fn unit(&mut self) -> f64 {
+        (self.next() >> 11) as f64 / (1u64 << 53) as f64
+    }
+}
+
+/// n keys in ascending order.
+pub fn sorted_keys(n: usize) -> Vec<u64> {
+    (0..n as u64).collect()
+}
+
+/// n distinct keys in random order.
+pub fn random_keys(n: usize, rng: &mut Rng) -> Vec<u64> {
+    let mut v = sorted_keys(n);
+    for i in (1..n).rev() {
+        v.swap(i, (rng.next() % (i as u64 + 1)) as usize);
+    }
+    v
+}
+
+/// n keys drawn from a Zipf distribution with exponent 1 over n distinct
+/// values, so a few hot keys repeat often. Ranks are scattered over the key
+/// space so the hot keys aren't all at one end of the tree.
+pub fn zipf_keys(n: usize, rng: &mut Rng) -> Vec<u64> {
+    let mut cdf = Vec::with_capacity(n);
+    let mut total = 0.0;
+    for rank in 1..n + 1 {
+        total += 1.0 / rank as f64;
+        cdf.push(total);
+    }
+    (0..n).map(|_| {
+        let u = rng.unit() * total;
+        let rank = match cdf.binary_search_by(|c| c.partial_cmp(&u).unwrap()) {
+            Ok(i) | Err(i) => i as u64
+        };
+        rank.wrapping_mul(0x9E3779B97F4A7C15) % n as u64
+    }).collect()
+}
+
+/// Time f once and return the nanoseconds per op for ops operations.
+pub fn time_per_op<F: FnOnce()>(ops: usize, f: F) -> f64 {
+    let start = Instant::now();
+    f();
+    let elapsed = start.elapsed();
+    (elapsed.as_secs() as f64 * 1e9 + elapsed.subsec_nanos() as f64) / ops as f64
+}
+
+fn report(order: &str, n: usize, structure: &str, op: &str, ns: f64) {
+    println!("{},{},{},{},{:.1}", order, n, structure, op, ns);
+}
+
+fn bench_avl(order: &str, keys: &[u64]) {
+    let n = keys.len();
+    let mut avl = AVL::with_capacity(n);
+    report(order, n, "AVL", "insert", time_per_op(n, || {
+        for &k in keys {
+            avl.insert(k, k);
+        }
+    }));
+    report(order, n, "AVL", "search", time_per_op(n, || {
+        for k in keys {
+            black_box(avl.search(k));
+        }
+    }));
+    report(order, n, "AVL", "range100", time_per_op(n, || {
+        for k in keys {
+            black_box(avl.lower_bound(k).take(100).count());
+        }
+    }));
+    report(order, n, "AVL", "rank", time_per_op(n, || {
+        for k in keys {
+            black_box(avl.rank(k));
+        }
+    }));
+    report(order, n, "AVL", "remove", time_per_op(n, || {
+        for k in keys {
+            black_box(avl.remove(k));
+        }
+    }));
+}
+
+fn bench_btreemap(order: &str, keys: &[u64]) {
+    let n = keys.len();
+    let mut map = BTreeMap::new();
+    report(order, n, "BTreeMap", "insert", time_per_op(n, || {
+        for &k in keys {
+            map.insert(k, k);
+        }
+    }));
+    report(order, n, "BTreeMap", "search", time_per_op(n, || {
+        for k in keys {
+            black_box(map.get(k));
+        }
+    }));
+    report(order, n, "BTreeMap", "range100", time_per_op(n, || {
+        for &k in keys {
+            black_box(map.range(k..).take(100).count());
+        }
+    }));
+    report(order, n, "BTreeMap", "remove", time_per_op(n, || {
+        for k in keys {
+            black_box(map.remove(k));
+        }
+    }));
+}
+
+// The pointer tree recurses on insert, so it only gets random keys where its
+// height stays near lg n.
+fn bench_bst(order: &str, keys: &[u64]) {
+    let n = keys.len();
+    let mut bst = BST::new();
+    report(order, n, "BST", "insert", time_per_op(n, || {
+        for &k in keys {
+            bst.insert(k, k);
+        }
+    }));
+    report(order, n, "BST", "search", time_per_op(n, || {
+        for k in keys {
+            black_box(bst.search(k));
+        }
+    }));
+}
+
+/// Compare the trees on sorted, random and Zipfian insert orders for sizes up
+/// to max_n, printing CSV. Note BTreeMap keeps one entry per key while the
+/// trees keep duplicates, which only matters for the Zipfian order.
+pub fn trees(max_n: usize) {
+    println!("order,n,structure,op,ns_per_op");
+    let mut n = 1000;
+    while n <= max_n {
+        let mut rng = Rng::new(n as u64);
+        let orders = [("sorted", sorted_keys(n)),
+                      ("random", random_keys(n, &mut rng)),
+                      ("zipf", zipf_keys(n, &mut rng))];
+        for &(order, ref keys) in orders.iter() {
+            bench_avl(order, keys);
+            bench_btreemap(order, keys);
+            if order == "random" {
+                bench_bst(order, keys);
+            }
+        }
+        n *= 10;
+    }
+}
+
+fn bench_lookups<F: Fn(u32) -> Option<u32>>(n: usize, structure: &str, queries: &[u32], f: F) {
+    let ns = time_per_op(queries.len(), || {
+        for &q in queries {
+            black_box(f(q));
+        }
+    });
+    println!("{},{},{:.1}", n, structure, ns);
+}
+
+/// Compare lower_bound over the static layouts with binary search on the
+/// sorted array and with the pointer tree, for sizes from 1K up to max_n,
+/// printing CSV. One layout is alive at a time, so the largest size needs
+/// about 8 bytes of memory per key.
+pub fn layouts(max_n: usize) {
+    println!("n,structure,ns_per_query");
+    let mut n = 1000;
+    while n <= max_n {
+        let mut rng = Rng::new(n as u64);
+        // odd keys, so half the queries miss.
+        let entries: Vec<(u32, ())> = (0..n as u32).map(|i| (2 * i + 1, ())).collect();
+        let queries: Vec<u32> = (0..1_000_000).map(|_| (rng.next() % (2 * n as u64 + 2)) as u32)
+                                              .collect();
+
+        bench_lookups(n, "binary_search", &queries, |q| {
+            entries.get(entries.partition_point(|&(k, _)| k < q)).map(|e| e.0)
+        });
+        {
+            let e = Eytzinger::from_sorted(&entries);
+            bench_lookups(n, "eytzinger", &queries, |q| e.lower_bound(&q).map(|(&k, _)| k));
+        }
+        {
+            let s = STree::from_sorted(&entries);
+            bench_lookups(n, "stree", &queries, |q| s.lower_bound(&q).map(|(&k, _)| k));
+        }
+        // boxed nodes cost a few dozen bytes each, so the pointer tree stops early.
+        if n <= 10_000_000 {
+            let mut bst = BST::new();
+            for (k, _) in random_keys(n, &mut rng).into_iter().map(|i| entries[i as usize]) {
+                bst.insert(k, ());
+            }
+            bench_lookups(n, "bst", &queries, |q| bst.search(&q).map(|_| q));
+        }
+        n *= 10;
+    }
+}
@@ -0,0 +1,479 @@
+use std::mem;
+
+use BST;
+
+/// Bytes per cache line; layouts start their keys on a line boundary.
+const LINE: usize = 64;
+
+/// A key that the S-tree can compare a whole node of at once.
+pub trait SearchKey: Ord + Copy {
+    /// Keys per S-tree node, one cache line worth.
+    const BLOCK: usize;
+    /// Fills the unused tail of the last S-tree nodes.
+    const MAX: Self;
+
+    /// Walk an S-tree of nodes nodes down to the slot of the first key not
+    /// less than x, which must exist. The node comparison is picked for the
+    /// CPU this runs on once per call, not once per node.
+    fn descend(keys: &[Self], nodes: usize, x: Self) -> usize {
+        descend_with(keys, nodes, x, rank_scalar::<Self>)
+    }
+}
+
+// Comparisons without branches, which the compiler can vectorize itself.
+#[inline(always)]
+fn rank_scalar<K: Ord + Copy>(block: &[K], x: K) -> usize {
+    block.iter().map(|&k| (k < x) as usize).sum()
+}
+
+// The search loop shared by every node comparison. It's always inlined so each
+// caller gets a copy compiled with its own target features and rank inlined.
+#[inline(always)]
+fn descend_with<K: SearchKey, R: Fn(&[K], K) -> usize>(keys: &[K], nodes: usize, x: K,
+                                                        rank: R) -> usize {
+    let b = K::BLOCK;
+    let mut best = 0;
+    let mut node = 0;
+    while node < nodes {
+        // the children are b + 1 adjacent lines. Prefetching the first two
+        // while this node is compared measured best; asking for all b + 1
+        // lines costs more than it saves.
+        let children = node * (b + 1) + 1;
+        prefetch(keys.as_ptr().wrapping_add(children * b));
+        prefetch(keys.as_ptr().wrapping_add((children + 1) * b));
+        let i = rank(&keys[node * b..node * b + b], x);
+        // select without branching: keep the old answer when every key in
+        // this node was smaller.
+        let here = node * b + i;
+        best = if i < b { here } else { best };
+        node = children + i;
+    }
+    best
+}
+
+macro_rules! scalar_search_key {
+    ($($t:ty),*) => {$(
+        impl SearchKey for $t {
+            const BLOCK: usize = LINE / mem::size_of::<$t>();
+            const MAX: $t = <$t>::max_value();
+        }
+    )*}
+}
+
+scalar_search_key!(i8, u8, i16, u16, isize, usize);
+
+macro_rules! simd_search_key {
+    ($($t:ty => $avx2:ident),*) => {$(
+        impl SearchKey for $t {
+            const BLOCK: usize = LINE / mem::size_of::<$t>();
+            const MAX: $t = <$t>::max_value();
+
+            #[cfg(target_arch = "x86_64")]
+            fn descend(keys: &[$t], nodes: usize, x: $t) -> usize {
+                if is_x86_feature_detected!("avx2") && is_x86_feature_detected!("popcnt") {
+                    unsafe { simd::$avx2(keys, nodes, x) }
+                } else {
+                    descend_with(keys, nodes, x, rank_scalar::<$t>)
+                }
+            }
+        }
+    )*}
+}
+
+simd_search_key!(i32 => descend_i32, u32 => descend_u32, i64 => descend_i64, u64 => descend_u64);
+
+/// AVX2 node comparisons. Each takes a whole cache line of keys, compares it
+/// against x in two 256 bit halves and counts the lanes that are less.
+/// Unsigned keys have their sign bits flipped to reuse the signed compares.
+#[cfg(target_arch = "x86_64")]
+mod simd {
+    use std::arch::x86_64::*;
+
+    #[target_feature(enable = "avx2,popcnt")]
+    unsafe fn count32(block: *const __m256i, x: __m256i, flip: __m256i) -> usize {
+        let lo = _mm256_xor_si256(_mm256_loadu_si256(block), flip);
+        let hi = _mm256_xor_si256(_mm256_loadu_si256(block.add(1)), flip);
+        let lo = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, lo)));
+        let hi = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, hi)));
+        ((lo as u32) | (hi as u32) << 8).count_ones() as usize
+    }
+
+    #[target_feature(enable = "avx2,popcnt")]
+    unsafe fn count64(block: *const __m256i, x: __m256i, flip: __m256i) -> usize {
+        let lo = _mm256_xor_si256(_mm256_loadu_si256(block), flip);
+        let hi = _mm256_xor_si256(_mm256_loadu_si256(block.add(1)), flip);
+        let lo = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, lo)));
+        let hi = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(x, hi)));
+        ((lo as u32) | (hi as u32) << 4).count_ones() as usize
+    }
+
+    #[target_feature(enable = "avx2,popcnt")]
+    fn rank_i32(block: &[i32], x: i32) -> usize {
+        debug_assert!(block.len() >= 16);
+        unsafe {
+            count32(block.as_ptr() as *const __m256i, _mm256_set1_epi32(x),
+                    _mm256_setzero_si256())
+        }
+    }
+
+    #[target_feature(enable = "avx2,popcnt")]
+    fn rank_u32(block: &[u32], x: u32) -> usize {
+        debug_assert!(block.len() >= 16);
+        let flip = _mm256_set1_epi32(i32::min_value());
+        let x = _mm256_xor_si256(_mm256_set1_epi32(x as i32), flip);
+        unsafe { count32(block.as_ptr() as *const __m256i, x, flip) }
+    }
+
+    #[target_feature(enable = "avx2,popcnt")]
+    fn rank_i64(block: &[i64], x: i64) -> usize {
+        debug_assert!(block.len() >= 8);
+        unsafe {
+            count64(block.as_ptr() as *const __m256i, _mm256_set1_epi64x(x),
+                    _mm256_setzero_si256())
+        }
+    }
+
+    #[target_feature(enable = "avx2,popcnt")]
+    fn rank_u64(block: &[u64], x: u64) -> usize {
+        debug_assert!(block.len() >= 8);
+        let flip = _mm256_set1_epi64x(i64::min_value());
+        let x = _mm256_xor_si256(_mm256_set1_epi64x(x as i64), flip);
+        unsafe { count64(block.as_ptr() as *const __m256i, x, flip) }
+    }
+
+    // Whole search loops compiled for AVX2, so the node comparison inlines.
+    macro_rules! avx2_descend {
+        ($($name:ident: $t:ty => $rank:ident),*) => {$(
+            #[target_feature(enable = "avx2,popcnt")]
+            pub unsafe fn $name(keys: &[$t], nodes: usize, x: $t) -> usize {
+                super::descend_with(keys, nodes, x, |block, x| $rank(block, x))
+            }
+        )*}
+    }
+
+    avx2_descend!(descend_i32: i32 => rank_i32, descend_u32: u32 => rank_u32,
+                  descend_i64: i64 => rank_i64, descend_u64: u64 => rank_u64);
+}
+
+#[inline(always)]
+fn prefetch<T>(p: *const T) {
+    #[cfg(target_arch = "x86_64")]
+    unsafe {
+        use std::arch::x86_64::{_mm_prefetch, _MM_HINT_T0};
+        _mm_prefetch::<_MM_HINT_T0>(p as *const i8);
+    }
+}
+
+// The number of elements to skip at the front of v so that element is on a
+// cache line boundary.
+fn line_offset<T>(v: &Vec<T>) -> usize {
+    let size = mem::size_of::<T>().max(1);
+    let misalign = v.as_ptr() as usize % LINE;
+    if misalign == 0 || LINE % size != 0 { 0 } else { (LINE - misalign) / size }
+}
+
+fn collect_inorder<K: Ord + Copy, D: Clone>(bst: &BST<K, D>) -> Vec<(K, D)> {
+    let mut entries = vec![];
+    bst.inorder(&mut |(&k, d)| entries.push((k, d.clone())));
+    entries
+}
+
+/// An immutable sorted set of keys in Eytzinger (breadth first) order: the
+/// children of slot k are slots 2k and 2k + 1. The top levels share a few
+/// cache lines, and since the 16 descendants four levels below a slot are
+/// adjacent the search can prefetch their lines (one for 4 byte keys, two for
+/// 8 byte keys) while it works on the levels between.
+pub struct Eytzinger<K: Ord + Copy, D> {
+    // slot k lives at keys[offset + k]; slot 0 is unused.
+    keys: Vec<K>,
+    data: Vec<D>,
+    offset: usize,
+    n: usize
+}
+
+impl<K: Ord + Copy, D: Clone> Eytzinger<K, D> {
+    /// Build from entries sorted by key.
+    /// time: n
+    pub fn from_sorted(entries: &[(K, D)]) -> Eytzinger<K, D> {
+        debug_assert!(entries.windows(2).all(|w| w[0].0 <= w[1].0));
+        let n = entries.len();
+        if n == 0 {
+            return Eytzinger { keys: vec![], data: vec![], offset: 0, n: 0 };
+        }
+
+        let mut keys = Vec::with_capacity(n + 1 + LINE);
+        keys.resize(n + 1 + LINE, entries[0].0);
+        let offset = line_offset(&keys);
+        keys.truncate(offset + n + 1);
+        let mut data = vec![entries[0].1.clone(); n + 1];
+
+        fn fill<K2: Copy, D2: Clone>(keys: &mut [K2], data: &mut [D2], entries: &[(K2, D2)],
+                                     k: usize, next: &mut usize) {
+            if k < keys.len() {
+                fill(keys, data, entries, 2 * k, next);
+                keys[k] = entries[*next].0;
+                data[k] = entries[*next].1.clone();
+                *next += 1;
+                fill(keys, data, entries, 2 * k + 1, next);
+            }
+        }
+        let mut next = 0;
+        fill(&mut keys[offset..], &mut data, entries, 1, &mut next);
+
+        Eytzinger { keys: keys, data: data, offset: offset, n: n }
+    }
+
+    /// Build from the inorder traversal of a pointer tree.
+    pub fn from_bst(bst: &BST<K, D>) -> Eytzinger<K, D> {
+        Eytzinger::from_sorted(&collect_inorder(bst))
+    }
+}
+
+impl<K: Ord + Copy, D> Eytzinger<K, D> {
+    pub fn len(&self) -> usize {
+        self.n
+    }
+
+    pub fn search(&self, target: &K) -> Option<&D> {
+        match self.lower_bound(target) {
+            Some((k, d)) if k == target => Some(d),
+            _ => None
+        }
+    }
+
+    pub fn minimum(&self) -> Option<(&K, &D)> {
+        if self.n == 0 {
+            return None;
+        }
+        let mut k = 1;
+        while 2 * k <= self.n {
+            k *= 2;
+        }
+        Some(self.entry(k))
+    }
+
+    pub fn maximum(&self) -> Option<(&K, &D)> {
+        if self.n == 0 {
+            return None;
+        }
+        let mut k = 1;
+        while 2 * k + 1 <= self.n {
+            k = 2 * k + 1;
+        }
+        Some(self.entry(k))
+    }
+
+    /// The first entry whose key is not less than target.
+    /// time: lg n, with no branches on the keys
+    pub fn lower_bound(&self, target: &K) -> Option<(&K, &D)> {
+        let keys = &self.keys[self.offset..];
+        let mut k = 1;
+        while k <= self.n {
+            // the 16 descendants span more than one line for keys wider than
+            // 4 bytes; the bound is a constant, so this unrolls.
+            let descendants = keys.as_ptr().wrapping_add(16 * k) as *const u8;
+            let mut line = 0;
+            while line < 16 * mem::size_of::<K>() {
+                prefetch(descendants.wrapping_add(line));
+                line += LINE;
+            }
+            k = 2 * k + (keys[k] < *target) as usize;
+        }
+        // each right turn appended a 1 bit; the answer is where the path last
+        // turned left, found by dropping the trailing ones and that zero.
+        k >>= (!k).trailing_zeros() + 1;
+        if k == 0 { None } else { Some(self.entry(k)) }
+    }
+
+    fn entry(&self, k: usize) -> (&K, &D) {
+        (&self.keys[self.offset + k], &self.data[k])
+    }
+}
+
+/// An immutable sorted set of keys in a static B-tree (S-tree) layout. Each
+/// node is one cache line of K::BLOCK keys with K::BLOCK + 1 implicit
+/// children, so a search touches about log_(BLOCK+1) n lines and compares
+/// each one with a few SIMD instructions.
+pub struct STree<K: SearchKey, D> {
+    // node i holds keys[offset + i * BLOCK ..][.. BLOCK], padded with K::MAX.
+    keys: Vec<K>,
+    data: Vec<D>,
+    offset: usize,
+    nodes: usize,
+    n: usize,
+    min: usize,
+    max: usize
+}
+
+impl<K: SearchKey, D: Clone> STree<K, D> {
+    /// Build from entries sorted by key.
+    /// time: n
+    pub fn from_sorted(entries: &[(K, D)]) -> STree<K, D> {
+        debug_assert!(entries.windows(2).all(|w| w[0].0 <= w[1].0));
+        let b = K::BLOCK;
+        let n = entries.len();
+        let nodes = (n + b - 1) / b;
+        let slots = nodes * b;
+
+        let mut keys = Vec::with_capacity(slots + LINE);
+        keys.resize(slots + LINE, K::MAX);
+        let offset = line_offset(&keys);
+        keys.truncate(offset + slots);
+        let mut data = match entries.last() {
+            Some(&(_, ref d)) => vec![d.clone(); slots],
+            None => vec![]
+        };
+
+        struct Fill<'a, K2: 'a, D2: 'a> {
+            keys: &'a mut [K2],
+            data: &'a mut [D2],
+            entries: &'a [(K2, D2)],
+            nodes: usize,
+            block: usize,
+            next: usize,
+            min: usize,
+            max: usize
+        }
+        fn fill<K2: Copy, D2: Clone>(f: &mut Fill<K2, D2>, node: usize) {
+            if node < f.nodes {
+                for i in 0..f.block {
+                    fill(f, node * (f.block + 1) + i + 1);
+                    if f.next < f.entries.len() {
+                        let slot = node * f.block + i;
+                        f.keys[slot] = f.entries[f.next].0;
+                        f.data[slot] = f.entries[f.next].1.clone();
+                        if f.next == 0 {
+                            f.min = slot;
+                        }
+                        f.max = slot;
+                        f.next += 1;
+                    }
+                }
+                fill(f, node * (f.block + 1) + f.block + 1);
+            }
+        }
+
+        let mut f = Fill { keys: &mut keys[offset..], data: &mut data, entries: entries,
+                           nodes: nodes, block: b, next: 0, min: 0, max: 0 };
+        fill(&mut f, 0);
+        let (min, max) = (f.min, f.max);
+
+        STree { keys: keys, data: data, offset: offset, nodes: nodes, n: n,
+                min: min, max: max }
+    }
+
+    /// Build from the inorder traversal of a pointer tree.
+    pub fn from_bst(bst: &BST<K, D>) -> STree<K, D> {
+        STree::from_sorted(&collect_inorder(bst))
+    }
+}
+
+impl<K: SearchKey, D> STree<K, D> {
+    pub fn len(&self) -> usize {
+        self.n
+    }
+
+    pub fn search(&self, target: &K) -> Option<&D> {
+        match self.lower_bound(target) {
+            Some((k, d)) if k == target => Some(d),
+            _ => None
+        }
+    }
+
+    pub fn minimum(&self) -> Option<(&K, &D)> {
+        if self.n == 0 { None } else { Some(self.entry(self.min)) }
+    }
+
+    pub fn maximum(&self) -> Option<(&K, &D)> {
+        if self.n == 0 { None } else { Some(self.entry(self.max)) }
+    }
+
+    /// The first entry whose key is not less than target.
+    /// time: log_(BLOCK+1) n node visits
+    pub fn lower_bound(&self, target: &K) -> Option<(&K, &D)> {
+        // past the largest key the search would land on padding.
+        if self.n == 0 || *target > self.keys[self.offset + self.max] {
+            return None;
+        }
+        Some(self.entry(K::descend(&self.keys[self.offset..], self.nodes, *target)))
+    }
+
+    fn entry(&self, slot: usize) -> (&K, &D) {
+        (&self.keys[self.offset + slot], &self.data[slot])
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{Eytzinger, STree};
+    use BST;
+
+    fn entries(n: u32) -> Vec<(u32, u32)> {
+        (0..n).map(|i| (i * 3 + 1, i)).collect()
+    }
+
+    // Compare every query against binary search on the sorted entries.
+    fn check_lower_bounds<F>(n: u32, lower_bound: F)
+        where F: Fn(&u32) -> Option<(u32, u32)> {
+
+        let sorted = entries(n);
+        for x in 0..n * 3 + 3 {
+            let i = sorted.partition_point(|&(k, _)| k < x);
+            assert_eq!(lower_bound(&x), sorted.get(i).cloned(), "n {} x {}", n, x);
+        }
+    }
+
+    #[test]
+    fn test_eytzinger() {
+        for &n in [0, 1, 2, 15, 16, 17, 100, 1000].iter() {
+            let e = Eytzinger::from_sorted(&entries(n));
+            assert_eq!(e.len(), n as usize);
+            check_lower_bounds(n, |x| e.lower_bound(x).map(|(&k, &d)| (k, d)));
+            assert_eq!(e.minimum().map(|(&k, _)| k), entries(n).first().map(|p| p.0));
+            assert_eq!(e.maximum().map(|(&k, _)| k), entries(n).last().map(|p| p.0));
+        }
+    }
+
+    #[test]
+    fn test_stree() {
+        for &n in [0, 1, 2, 15, 16, 17, 100, 289, 1000, 5000].iter() {
+            let s = STree::from_sorted(&entries(n));
+            assert_eq!(s.len(), n as usize);
+            check_lower_bounds(n, |x| s.lower_bound(x).map(|(&k, &d)| (k, d)));
+            assert_eq!(s.minimum().map(|(&k, _)| k), entries(n).first().map(|p| p.0));
+            assert_eq!(s.maximum().map(|(&k, _)| k), entries(n).last().map(|p| p.0));
+        }
+    }
+
+    #[test]
+    fn test_stree_signed_and_wide_keys() {
+        let signed: Vec<(i32, ())> = (-500..500).map(|i| (i * 2, ())).collect();
+        let s = STree::from_sorted(&signed);
+        assert_eq!(s.lower_bound(&-7).map(|(&k, _)| k), Some(-6));
+        assert!(s.search(&-7).is_none());
+        assert!(s.search(&-8).is_some());
+
+        let wide: Vec<(u64, ())> = (0..1000).map(|i| ((1 << 63) + i * 2, ())).collect();
+        let s = STree::from_sorted(&wide);
+        assert_eq!(s.lower_bound(&((1 << 63) + 7)).map(|(&k, _)| k), Some((1 << 63) + 8));
+        assert_eq!(s.lower_bound(&0).map(|(&k, _)| k), Some(1 << 63));
+        assert!(s.lower_bound(&u64::max_value()).is_none());
+    }
+
+    #[test]
+    fn test_from_bst() {
+        let data = [4, 9, 8, 6, 0, 5, 1, 7, 2, 3];
+        let mut bst = BST::new();
+        for &i in data.iter() {
+            bst.insert(i as u32, i * 10);
+        }
+        let e = Eytzinger::from_bst(&bst);
+        let s = STree::from_bst(&bst);
+        for &i in data.iter() {
+            assert_eq!(e.search(&(i as u32)), Some(&(i * 10)));
+            assert_eq!(s.search(&(i as u32)), Some(&(i * 10)));
+        }
+        assert!(e.search(&10).is_none());
+        assert!(s.search(&10).is_none());
+    }
+}
@@ -1,3 +1,10 @@
+mod avl;
+mod bench;
+// the benchmarks only use lower_bound; the rest of the API is for tests and
+// callers of the layouts.
+#[cfg_attr(not(test), allow(dead_code))]
+mod layout;
+
 type OBox<T> = Option<Box<T>>;
 
 struct Node<K: Ord, D> {
@@ -102,8 +109,17 @@ impl<K: Ord, D> BST<K, D> {
     }
 }
 
+// Usage: bst bench [max n] | bst bench-layouts [max n]
+// Runs the tree or static layout benchmarks and prints the results as CSV.
+// Build with --release for meaningful numbers.
 fn main() {
-    println!("Hello, world!");
+    let args: Vec<String> = std::env::args().collect();
+    let max_n = args.get(2).and_then(|s| s.parse().ok());
+    match args.get(1).map(|s| s.as_str()) {
+        Some("bench") => bench::trees(max_n.unwrap_or(1_000_000)),
+        Some("bench-layouts") => bench::layouts(max_n.unwrap_or(10_000_000)),
+        _ => println!("usage: bst bench [max n] | bst bench-layouts [max n]")
+    }
 }
 
 #[cfg(test)]
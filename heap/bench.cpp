@@ -0,0 +1,474 @@
+#include "heap.hpp"
+
+#include <vector>
+#include <queue>
+#include <string>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using std::int32_t;
+using std::uint64_t;
+
+// Hardware cache miss and branch mispredict counters for the calling thread.
+// Falls back to reporting nothing when perf_event_open is unavailable, e.g.
+// inside containers or with a strict kernel.perf_event_paranoid.
+class PerfCounters {
+public:
+    // Open the counters, unless enabled is false in which case they are left
+    // unavailable.
+    explicit PerfCounters(bool enabled = true) {
+        cacheFd = enabled ? open(PERF_COUNT_HW_CACHE_MISSES, -1) : -1;
+        branchFd = cacheFd >= 0 ? open(PERF_COUNT_HW_BRANCH_MISSES, cacheFd) : -1;
+        if (branchFd < 0 && cacheFd >= 0) {
+            ::close(cacheFd);
+            cacheFd = -1;
+        }
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters & operator=(const PerfCounters &) = delete;
+
+    ~PerfCounters() {
+        if (available()) {
+            ::close(branchFd);
+            ::close(cacheFd);
+        }
+    }
+
+    bool available() const {
+        return cacheFd >= 0;
+    }
+
+    void start() {
+#ifdef __linux__
+        if (available()) {
+            ioctl(cacheFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(cacheFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    // Stop counting and add the counts since start to the arguments.
+    void stop(uint64_t &cacheMisses, uint64_t &branchMisses) {
+#ifdef __linux__
+        if (available()) {
+            ioctl(cacheFd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            cacheMisses += readCount(cacheFd);
+            branchMisses += readCount(branchFd);
+        }
+#endif
+    }
+
+private:
+    static int open(uint64_t config, int groupFd) {
+#ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = groupFd < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+#else
+        return -1;
+#endif
+    }
+
+    static uint64_t readCount(int fd) {
+        uint64_t count = 0;
+        if (::read(fd, &count, sizeof(count)) != sizeof(count)) {
+            return 0;
+        }
+        return count;
+    }
+
+    int cacheFd;
+    int branchFd;
+};
+
+// A larger element keyed on its first field, to see the cost of moving more bytes.
+struct Record {
+    uint64_t key;
+    uint64_t payload[3];
+};
+
+bool operator<(const Record &a, const Record &b) {
+    return a.key < b.key;
+}
+
+// Build an element from a random number.
+template <class T>
+T makeElem(uint64_t x) {
+    return static_cast<T>(x);
+}
+
+template <>
+Record makeElem<Record>(uint64_t x) {
+    Record r = {x, {x, x, x}};
+    return r;
+}
+
+// The priority given to an element that goes back in during the hold model.
+template <class T>
+T advance(T elem, uint64_t x) {
+    return static_cast<T>(elem + static_cast<T>(x % 1024));
+}
+
+template <>
+Record advance<Record>(Record elem, uint64_t x) {
+    elem.key += x % 1024;
+    return elem;
+}
+
+template <class T>
+const char *typeName();
+template <> const char *typeName<int32_t>() { return "int32"; }
+template <> const char *typeName<uint64_t>() { return "uint64"; }
+template <> const char *typeName<Record>() { return "record32"; }
+
+// Number of comparisons made through CountingLess.
+static uint64_t comparisons = 0;
+
+// Plain and instrumented orderings. Every implementation is set up so that the
+// least element is on top.
+template <class T>
+struct Less {
+    bool operator()(const T &a, const T &b) const {
+        return a < b;
+    }
+};
+
+template <class T>
+struct CountingLess {
+    bool operator()(const T &a, const T &b) const {
+        ++comparisons;
+        return a < b;
+    }
+};
+
+// Flips a comparator for the standard library, which keeps the greatest on top.
+template <class C>
+struct Reverse {
+    template <class T>
+    bool operator()(const T &a, const T &b) const {
+        return C()(b, a);
+    }
+};
+
+template <class T, class C>
+struct HeapImpl {
+    static const char *name() { return "Heap"; }
+
+    HeapImpl() : heap(C()) {}
+    HeapImpl(std::vector<T> v) : heap(std::move(v), C()) {}
+
+    void insert(T elem) { heap.insert(elem); }
+    T pop() { return heap.pop(); }
+    bool sort() { heap.heapSort(); return true; }
+
+    Heap<T> heap;
+};
+
+template <class T, class C>
+struct PriorityQueueImpl {
+    static const char *name() { return "std::priority_queue"; }
+
+    PriorityQueueImpl() {}
+    PriorityQueueImpl(std::vector<T> v) : queue(Reverse<C>(), std::move(v)) {}
+
+    void insert(T elem) { queue.push(elem); }
+    T pop() { T top = queue.top(); queue.pop(); return top; }
+    bool sort() { return false; }
+
+    std::priority_queue<T, std::vector<T>, Reverse<C> > queue;
+};
+
+template <class T, class C>
+struct MakeHeapImpl {
+    static const char *name() { return "std::make_heap"; }
+
+    MakeHeapImpl() {}
+    MakeHeapImpl(std::vector<T> v) : array(std::move(v)) {
+        std::make_heap(array.begin(), array.end(), Reverse<C>());
+    }
+
+    void insert(T elem) {
+        array.push_back(elem);
+        std::push_heap(array.begin(), array.end(), Reverse<C>());
+    }
+    T pop() {
+        std::pop_heap(array.begin(), array.end(), Reverse<C>());
+        T top = array.back();
+        array.pop_back();
+        return top;
+    }
+    bool sort() {
+        std::sort_heap(array.begin(), array.end(), Reverse<C>());
+        return true;
+    }
+
+    std::vector<T> array;
+};
+
+struct Result {
+    std::string impl;
+    std::string op;
+    std::string type;
+    std::size_t n;
+    double nsPerOp;
+    double comparisonsPerOp;
+    bool hardware;
+    double cacheMissesPerOp;
+    double branchMissesPerOp;
+};
+
+// Totals gathered over the repetitions of one benchmark.
+struct Measurement {
+    double ns;
+    uint64_t ops;
+    uint64_t cacheMisses;
+    uint64_t branchMisses;
+    // Comparisons made inside the timed regions, when Impl counts them.
+    uint64_t comparisons;
+};
+
+// Keeps popped values alive so the work isn't optimized away.
+static volatile uint64_t sink;
+
+template <class T>
+uint64_t keyOf(const T &elem) {
+    return static_cast<uint64_t>(elem);
+}
+
+template <>
+uint64_t keyOf<Record>(const Record &elem) {
+    return elem.key;
+}
+
+// Run one operation of Impl over n elements reps times. Only the part of each
+// repetition that does the operation is timed and counted.
+// Returns false if Impl doesn't support the operation.
+template <class Impl, class T>
+bool measure(const std::string &op, const std::vector<T> &keys,
+             const std::vector<uint64_t> &noise, std::size_t reps,
+             PerfCounters &perf, Measurement &m) {
+    typedef std::chrono::steady_clock clock;
+    std::size_t n = keys.size();
+    m.ns = 0;
+    m.ops = 0;
+    m.cacheMisses = 0;
+    m.branchMisses = 0;
+    m.comparisons = 0;
+
+    for (std::size_t r = 0; r < reps; ++r) {
+        uint64_t acc = 0;
+        clock::time_point start;
+        clock::time_point end;
+        // setup builds heaps too, so only the comparisons between start and
+        // end belong to the op.
+        uint64_t startComparisons = 0;
+
+        if (op == "insert") {
+            Impl impl;
+            perf.start();
+            startComparisons = comparisons;
+            start = clock::now();
+            for (std::size_t i = 0; i < n; ++i) {
+                impl.insert(keys[i]);
+            }
+            end = clock::now();
+            m.comparisons += comparisons - startComparisons;
+            perf.stop(m.cacheMisses, m.branchMisses);
+        } else if (op == "pop") {
+            Impl impl(keys);
+            perf.start();
+            startComparisons = comparisons;
+            start = clock::now();
+            for (std::size_t i = 0; i < n; ++i) {
+                acc += keyOf(impl.pop());
+            }
+            end = clock::now();
+            m.comparisons += comparisons - startComparisons;
+            perf.stop(m.cacheMisses, m.branchMisses);
+        } else if (op == "hold") {
+            // the hold model: each step pops the top and reinserts it with a
+            // later priority, keeping the heap at size n.
+            Impl impl(keys);
+            perf.start();
+            startComparisons = comparisons;
+            start = clock::now();
+            for (std::size_t i = 0; i < n; ++i) {
+                T top = impl.pop();
+                impl.insert(advance(top, noise[i]));
+            }
+            end = clock::now();
+            m.comparisons += comparisons - startComparisons;
+            perf.stop(m.cacheMisses, m.branchMisses);
+        } else if (op == "heapify") {
+            std::vector<T> copy(keys);
+            perf.start();
+            startComparisons = comparisons;
+            start = clock::now();
+            Impl impl(std::move(copy));
+            end = clock::now();
+            m.comparisons += comparisons - startComparisons;
+            perf.stop(m.cacheMisses, m.branchMisses);
+            acc += keyOf(impl.pop());
+        } else if (op == "heapSort") {
+            Impl impl(keys);
+            perf.start();
+            startComparisons = comparisons;
+            start = clock::now();
+            bool supported = impl.sort();
+            end = clock::now();
+            m.comparisons += comparisons - startComparisons;
+            perf.stop(m.cacheMisses, m.branchMisses);
+            if (!supported) {
+                return false;
+            }
+        }
+
+        sink = acc;
+        m.ns += std::chrono::duration<double, std::nano>(end - start).count();
+        m.ops += n;
+    }
+    return true;
+}
+
+// Benchmark one implementation and element type, appending a result per op.
+// Each op runs once with a plain comparator for time and hardware counters and
+// once more with the counting comparator for comparisons.
+template <template <class, class> class Impl, class T>
+void run(const std::vector<std::size_t> &sizes, PerfCounters &perf,
+         std::vector<Result> &results) {
+    const char *ops[] = {"insert", "pop", "hold", "heapify", "heapSort"};
+
+    for (std::size_t n : sizes) {
+        std::mt19937_64 gen(n);
+        std::vector<T> keys(n);
+        std::vector<uint64_t> noise(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            keys[i] = makeElem<T>(gen());
+            noise[i] = gen();
+        }
+        std::size_t reps = std::max<std::size_t>(1, (1 << 20) / n);
+
+        for (const char *op : ops) {
+            Measurement timed;
+            Measurement counted;
+            if (!measure<Impl<T, Less<T> > >(op, keys, noise, reps, perf, timed)) {
+                continue;
+            }
+            PerfCounters off(false);
+            measure<Impl<T, CountingLess<T> > >(op, keys, noise, reps, off, counted);
+
+            Result res;
+            res.impl = Impl<T, Less<T> >::name();
+            res.op = op;
+            res.type = typeName<T>();
+            res.n = n;
+            res.nsPerOp = timed.ns / timed.ops;
+            res.comparisonsPerOp = double(counted.comparisons) / counted.ops;
+            res.hardware = perf.available();
+            res.cacheMissesPerOp = double(timed.cacheMisses) / timed.ops;
+            res.branchMissesPerOp = double(timed.branchMisses) / timed.ops;
+            results.push_back(res);
+            std::fprintf(stderr, "%s %s %s n=%zu: %.1f ns/op\n", res.impl.c_str(),
+                         op, res.type.c_str(), n, res.nsPerOp);
+        }
+    }
+}
+
+template <class T>
+void runAll(const std::vector<std::size_t> &sizes, PerfCounters &perf,
+            std::vector<Result> &results) {
+    run<HeapImpl, T>(sizes, perf, results);
+    run<PriorityQueueImpl, T>(sizes, perf, results);
+    run<MakeHeapImpl, T>(sizes, perf, results);
+}
+
+void printCsv(const std::vector<Result> &results) {
+    std::printf("impl,op,type,n,ns_per_op,comparisons_per_op,"
+                "cache_misses_per_op,branch_misses_per_op\n");
+    for (const Result &r : results) {
+        std::printf("%s,%s,%s,%zu,%.3f,%.3f,", r.impl.c_str(), r.op.c_str(),
+                    r.type.c_str(), r.n, r.nsPerOp, r.comparisonsPerOp);
+        if (r.hardware) {
+            std::printf("%.4f,%.4f\n", r.cacheMissesPerOp, r.branchMissesPerOp);
+        } else {
+            std::printf(",\n");
+        }
+    }
+}
+
+void printJson(const std::vector<Result> &results) {
+    std::printf("[\n");
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        std::printf("  {\"impl\": \"%s\", \"op\": \"%s\", \"type\": \"%s\", \"n\": %zu, "
+                    "\"ns_per_op\": %.3f, \"comparisons_per_op\": %.3f, ",
+                    r.impl.c_str(), r.op.c_str(), r.type.c_str(), r.n,
+                    r.nsPerOp, r.comparisonsPerOp);
+        if (r.hardware) {
+            std::printf("\"cache_misses_per_op\": %.4f, \"branch_misses_per_op\": %.4f}",
+                        r.cacheMissesPerOp, r.branchMissesPerOp);
+        } else {
+            std::printf("\"cache_misses_per_op\": null, \"branch_misses_per_op\": null}");
+        }
+        std::printf(i + 1 < results.size() ? ",\n" : "\n");
+    }
+    std::printf("]\n");
+}
+
+// Usage: bench [--json] [max n]
+// Benchmarks Heap against std::priority_queue and std::make_heap for sizes
+// from 1K up to max n (default 1M) and prints the results as CSV or JSON.
+// Progress goes to stderr so stdout can be saved for regression tracking.
+int main(int argc, char **argv) {
+    bool json = false;
+    std::size_t maxN = 1 << 20;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else {
+            maxN = std::strtoul(argv[i], nullptr, 10);
+        }
+    }
+
+    std::vector<std::size_t> sizes;
+    for (std::size_t n = 1 << 10; n <= maxN; n *= 4) {
+        sizes.push_back(n);
+    }
+
+    PerfCounters perf;
+    if (!perf.available()) {
+        std::fprintf(stderr, "perf_event_open unavailable, skipping hardware counters\n");
+    }
+
+    std::vector<Result> results;
+    runAll<int32_t>(sizes, perf, results);
+    runAll<uint64_t>(sizes, perf, results);
+    runAll<Record>(sizes, perf, results);
+
+    if (json) {
+        printJson(results);
+    } else {
+        printCsv(results);
+    }
+    return 0;
+}
@@ -0,0 +1,407 @@
+#include "heap.hpp"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef EXTSORT_HPP
+#define EXTSORT_HPP
+
+// Throw a runtime_error describing a failed system call on the given path.
+inline void extsortFail(const std::string &what, const std::string &path) {
+    throw std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+// Reads fixed size records of type T from a file through a large buffer.
+// After each refill the kernel is asked to start reading the following window
+// so the disk works on the next block while the caller consumes this one.
+template <class T>
+class RunReader {
+public:
+    RunReader(const std::string &path, std::size_t bufferBytes) {
+        this->path = path;
+        this->fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            extsortFail("open", path);
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        this->buffer.resize(std::max<std::size_t>(1, bufferBytes / sizeof(T)));
+        this->pos = 0;
+        this->len = 0;
+        this->offset = 0;
+        this->eof = false;
+    }
+
+    RunReader(const RunReader &) = delete;
+    RunReader & operator=(const RunReader &) = delete;
+
+    ~RunReader() {
+        ::close(fd);
+    }
+
+    // Read the next record into out. Returns false at the end of the file.
+    bool next(T &out) {
+        if (pos == len) {
+            if (eof) {
+                return false;
+            }
+            refill();
+            if (len == 0) {
+                return false;
+            }
+        }
+        out = buffer[pos++];
+        return true;
+    }
+
+private:
+    void refill() {
+        char *bytes = reinterpret_cast<char *>(buffer.data());
+        std::size_t want = buffer.size() * sizeof(T);
+        std::size_t got = 0;
+        while (got < want) {
+            ssize_t n = ::read(fd, bytes + got, want - got);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                extsortFail("read", path);
+            }
+            if (n == 0) {
+                eof = true;
+                break;
+            }
+            got += n;
+        }
+        if (got % sizeof(T) != 0) {
+            throw std::runtime_error("truncated record in " + path);
+        }
+        offset += got;
+#ifdef POSIX_FADV_WILLNEED
+        if (!eof) {
+            // read-ahead: hint the next window while this one is consumed.
+            posix_fadvise(fd, offset, want, POSIX_FADV_WILLNEED);
+        }
+#endif
+
+        pos = 0;
+        len = got / sizeof(T);
+    }
+
+    std::string path;
+    int fd;
+    std::vector<T> buffer;
+    std::size_t pos;
+    std::size_t len;
+    off_t offset;
+    bool eof;
+};
+
+// Writes fixed size records of type T to a file through a large buffer.
+template <class T>
+class RunWriter {
+public:
+    RunWriter(const std::string &path, std::size_t bufferBytes) {
+        this->path = path;
+        this->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            extsortFail("open", path);
+        }
+        this->buffer.reserve(std::max<std::size_t>(1, bufferBytes / sizeof(T)));
+    }
+
+    RunWriter(const RunWriter &) = delete;
+    RunWriter & operator=(const RunWriter &) = delete;
+
+    ~RunWriter() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    // Append a record.
+    void write(const T &elem) {
+        if (buffer.size() == buffer.capacity()) {
+            flush();
+        }
+        buffer.push_back(elem);
+    }
+
+    // Flush the buffer and close the file.
+    void close() {
+        flush();
+        if (::close(fd) != 0) {
+            fd = -1;
+            extsortFail("close", path);
+        }
+        fd = -1;
+    }
+
+private:
+    void flush() {
+        const char *bytes = reinterpret_cast<const char *>(buffer.data());
+        std::size_t want = buffer.size() * sizeof(T);
+        std::size_t done = 0;
+        while (done < want) {
+            ssize_t n = ::write(fd, bytes + done, want - done);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                extsortFail("write", path);
+            }
+            done += n;
+        }
+        buffer.clear();
+    }
+
+    std::string path;
+    int fd;
+    std::vector<T> buffer;
+};
+
+// What an ExternalSort::sort call did and how long it took.
+struct ExternalSortStats {
+    std::uint64_t bytes;
+    std::size_t runs;
+    std::size_t mergePasses;
+    double runSeconds;
+    double mergeSeconds;
+
+    double seconds() const {
+        return runSeconds + mergeSeconds;
+    }
+
+    // Input megabytes (2^20 bytes) sorted per second, end to end.
+    double throughputMBs() const {
+        double s = seconds();
+        return s > 0 ? (bytes / 1048576.0) / s : 0;
+    }
+};
+
+// Sort files of fixed size records that are bigger than memory.
+//
+// Runs are produced by replacement selection on a Heap, which on random input
+// gives runs about twice as long as the number of records that fit in memory.
+// Up to an eighth of the budget goes to I/O buffers, so runs come out at 1.75
+// to 2 times memoryBytes.
+// The runs are then combined with a k-way merge, again on a Heap, in as many
+// passes as the memory budget's fan-in requires.
+//
+// T must be trivially copyable since records are written to disk as raw bytes.
+template <class T>
+class ExternalSort {
+public:
+    // The comp function returns true if the first arg should come before the
+    // second arg in the output. memoryBytes bounds the records and I/O buffers
+    // held at once, and the runs are written to files in tmpDir.
+    ExternalSort(std::function<bool(T, T)> comp, std::size_t memoryBytes,
+                 std::string tmpDir) {
+        this->comp = comp;
+        this->memoryBytes = std::max<std::size_t>(memoryBytes, 16 * sizeof(T));
+        this->tmpDir = std::move(tmpDir);
+        this->runCounter = 0;
+    }
+
+    // Sort the records in inPath and write them to outPath. If reading or
+    // writing fails the run files made so far are removed before rethrowing.
+    // time: n * lg n, with about 1 + log_k(n / memory) passes over the data.
+    ExternalSortStats sort(const std::string &inPath, const std::string &outPath) {
+        try {
+            ExternalSortStats stats = sortFiles(inPath, outPath);
+            runPaths.clear();
+            return stats;
+        } catch (...) {
+            for (std::size_t i = 0; i < runPaths.size(); ++i) {
+                std::remove(runPaths[i].c_str());
+            }
+            runPaths.clear();
+            throw;
+        }
+    }
+
+private:
+    // Smallest buffer worth giving each run during a merge.
+    static const std::size_t mergeBufferBytes = 1 << 20;
+
+    // Do the work of sort, leaving the cleanup after failures to it.
+    ExternalSortStats sortFiles(const std::string &inPath, const std::string &outPath) {
+        typedef std::chrono::steady_clock clock;
+        ExternalSortStats stats;
+        stats.bytes = 0;
+        stats.mergePasses = 0;
+
+        clock::time_point start = clock::now();
+        std::vector<std::string> runs = makeRuns(inPath, stats);
+        clock::time_point formed = clock::now();
+        stats.runs = runs.size();
+
+        std::size_t fanIn = mergeFanIn();
+        while (runs.size() > fanIn) {
+            std::vector<std::string> merged;
+            for (std::size_t i = 0; i < runs.size(); i += fanIn) {
+                std::size_t end = std::min(runs.size(), i + fanIn);
+                std::vector<std::string> group(runs.begin() + i, runs.begin() + end);
+                std::string path = nextRunPath();
+                mergeRuns(group, path);
+                merged.push_back(path);
+            }
+            runs = std::move(merged);
+            ++stats.mergePasses;
+        }
+
+        if (runs.size() == 1 && std::rename(runs[0].c_str(), outPath.c_str()) == 0) {
+            // a single run is already the answer.
+        } else {
+            mergeRuns(runs, outPath);
+            ++stats.mergePasses;
+        }
+
+        stats.runSeconds = std::chrono::duration<double>(formed - start).count();
+        stats.mergeSeconds = std::chrono::duration<double>(clock::now() - formed).count();
+        return stats;
+    }
+
+    // Produce sorted runs from the input using replacement selection.
+    // time: n * lg m where m is the number of records that fit in memory.
+    std::vector<std::string> makeRuns(const std::string &inPath,
+                                      ExternalSortStats &stats) {
+        std::size_t ioBytes = std::max(sizeof(T),
+            std::min<std::size_t>(memoryBytes / 16, 8 << 20));
+        std::size_t capacity = std::max<std::size_t>(1,
+            (memoryBytes - 2 * ioBytes) / sizeof(T));
+
+        // The current run and the next one share one heap without tagging the
+        // records: a record belongs to the next run exactly when it sorts before
+        // the last record written, and that can't change until the run ends
+        // since last only grows. So the next run's records just order after
+        // the current run's.
+        T last = T();
+        bool writing = false;
+        std::function<bool(T, T)> c = comp;
+        std::function<bool(T, T)> runComp = [c, &last, &writing](T a, T b) {
+            if (writing) {
+                bool aNext = c(a, last);
+                bool bNext = c(b, last);
+                if (aNext != bNext) {
+                    return bNext;
+                }
+            }
+            return c(a, b);
+        };
+
+        RunReader<T> input(inPath, ioBytes);
+        // one spare slot for the placeholder Heap puts at position 0, so
+        // building the heap doesn't reallocate a full vector.
+        std::vector<T> initial;
+        initial.reserve(capacity + 1);
+        T elem;
+        while (initial.size() < capacity && input.next(elem)) {
+            initial.push_back(elem);
+        }
+        stats.bytes += initial.size() * sizeof(T);
+        Heap<T> heap(std::move(initial), runComp);
+
+        std::vector<std::string> runs;
+        std::unique_ptr<RunWriter<T> > out;
+        while (heap.getHeapSize() != 0) {
+            T top = heap.pop();
+            // the top only belongs to the next run once the current one is used
+            // up, and then every record left is at least top.
+            if (!out || comp(top, last)) {
+                if (out) {
+                    out->close();
+                }
+                runs.push_back(nextRunPath());
+                out.reset(new RunWriter<T>(runs.back(), ioBytes));
+            }
+            last = top;
+            writing = true;
+            out->write(top);
+
+            if (input.next(elem)) {
+                stats.bytes += sizeof(T);
+                heap.insert(elem);
+            }
+        }
+        if (out) {
+            out->close();
+        }
+        return runs;
+    }
+
+    // Merge the given runs into outPath and delete them.
+    // time: n * lg k
+    void mergeRuns(const std::vector<std::string> &runs, const std::string &outPath) {
+        typedef std::pair<T, std::size_t> Head;
+
+        std::size_t bufferBytes = std::max(sizeof(T), memoryBytes / (runs.size() + 1));
+        std::vector<std::unique_ptr<RunReader<T> > > readers;
+        std::vector<Head> heads;
+        for (std::size_t i = 0; i < runs.size(); ++i) {
+            readers.emplace_back(new RunReader<T>(runs[i], bufferBytes));
+            T elem;
+            if (readers[i]->next(elem)) {
+                heads.push_back(Head(elem, i));
+            }
+        }
+
+        std::function<bool(T, T)> c = comp;
+        Heap<Head> heap(std::move(heads), [c](Head a, Head b) {
+            return c(a.first, b.first);
+        });
+
+        RunWriter<T> out(outPath, bufferBytes);
+        while (heap.getHeapSize() != 0) {
+            Head top = heap.pop();
+            out.write(top.first);
+            if (readers[top.second]->next(top.first)) {
+                heap.insert(top);
+            }
+        }
+        out.close();
+
+        readers.clear();
+        for (std::size_t i = 0; i < runs.size(); ++i) {
+            std::remove(runs[i].c_str());
+        }
+    }
+
+    // The number of runs merged at once without starving their buffers.
+    std::size_t mergeFanIn() {
+        std::size_t buffers = memoryBytes / mergeBufferBytes;
+        return buffers > 3 ? buffers - 1 : 2;
+    }
+
+    // Name a new run file and remember it in case the sort fails.
+    std::string nextRunPath() {
+        runPaths.push_back(tmpDir + "/extsort-" + std::to_string(::getpid()) + "-" +
+                           std::to_string(runCounter++) + ".run");
+        return runPaths.back();
+    }
+
+    std::function<bool(T, T)> comp;
+    std::size_t memoryBytes;
+    std::string tmpDir;
+    std::size_t runCounter;
+    // Every run file this sort has made; the finished ones are already gone.
+    std::vector<std::string> runPaths;
+};
+
+#endif
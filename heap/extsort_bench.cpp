@@ -0,0 +1,75 @@
+#include "extsort.hpp"
+
+#include <vector>
+#include <string>
+#include <random>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+
+using std::uint64_t;
+
+// Write n random records to path.
+void generate(const std::string &path, std::size_t n) {
+    std::mt19937_64 gen(n);
+    RunWriter<uint64_t> out(path, 8 << 20);
+    for (std::size_t i = 0; i < n; ++i) {
+        out.write(gen());
+    }
+    out.close();
+}
+
+// Check that path holds n records in order.
+bool verify(const std::string &path, std::size_t n) {
+    RunReader<uint64_t> in(path, 8 << 20);
+    std::size_t count = 0;
+    uint64_t prev = 0;
+    uint64_t elem;
+    while (in.next(elem)) {
+        if (count != 0 && elem < prev) {
+            return false;
+        }
+        prev = elem;
+        ++count;
+    }
+    return count == n;
+}
+
+// Usage: extsort_bench [tmpdir] [max input MB]
+// Sorts files of random uint64_t of growing size under several memory budgets
+// and prints one CSV row per combination.
+int main(int argc, char **argv) {
+    std::string tmpDir = argc > 1 ? argv[1] : "/tmp";
+    std::size_t maxInputMB = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 256;
+
+    std::vector<std::size_t> memoryMBs {4, 16, 64};
+    std::string in = tmpDir + "/extsort-bench.in";
+    std::string out = tmpDir + "/extsort-bench.out";
+
+    std::cout << "input_mb,memory_mb,runs,merge_passes,run_s,merge_s,mb_per_s" << std::endl;
+    for (std::size_t inputMB = 16; inputMB <= maxInputMB; inputMB *= 4) {
+        std::size_t n = (inputMB << 20) / sizeof(uint64_t);
+        generate(in, n);
+        for (std::size_t memoryMB : memoryMBs) {
+            if (memoryMB >= inputMB) {
+                continue;
+            }
+            ExternalSort<uint64_t> sorter([](uint64_t a, uint64_t b) { return a < b; },
+                                          memoryMB << 20, tmpDir);
+            ExternalSortStats stats = sorter.sort(in, out);
+            if (!verify(out, n)) {
+                std::cerr << "output not sorted for input " << inputMB
+                          << "MB, memory " << memoryMB << "MB" << std::endl;
+                return 1;
+            }
+            std::printf("%zu,%zu,%zu,%zu,%.3f,%.3f,%.1f\n", inputMB, memoryMB,
+                        stats.runs, stats.mergePasses, stats.runSeconds,
+                        stats.mergeSeconds, stats.throughputMBs());
+        }
+    }
+    std::remove(in.c_str());
+    std::remove(out.c_str());
+
+    return 0;
+}
@@ -31,14 +31,8 @@ public:
         this->comp = comp;
         this->array = std::move(array);
 
-        // get rightmost node of second deepest layer. 
-        std::size_t j = 1;
-        while (j * 2 < heapSize) {
-            j *= 2;
-        }
-
         // bubble down each node, skipping the ones that are already leaves.
-        for (std::size_t i = j - 1; i >= 1; --i) {
+        for (std::size_t i = heapSize / 2; i >= 1; --i) {
             Heap::bubble_down(i);
         }
     }
@@ -1,9 +1,13 @@
 #include "heap.hpp"
+#include "extsort.hpp"
 
 #include <vector>
 #include <cstdint>
 #include <iostream>
 #include <algorithm>
+#include <random>
+#include <fstream>
+#include <cstdio>
 
 using std::int32_t;
 
@@ -20,6 +24,16 @@ void testHeapifyNothing() {
     Heap<int32_t> heap(nothing, comp);
 }
 
+void testHeapifyTwo() {
+    std::vector<int32_t> two {9, 1};
+    Heap<int32_t> heap(two, comp);
+    if (heap.peek() == 1) {
+        std::cout << "  heapify two PASS" << std::endl;
+    } else {
+        std::cout << "  heapify two FAIL" << std::endl;
+    }
+}
+
 void testHeapSort() {
     std::vector<int32_t> initial {9, 1, 6, 3, 10, 5, 2, 7, 8, 0, 4};
     Heap<int32_t> heap(initial, comp);
@@ -68,6 +82,62 @@ void testPriorityQueue() {
     }
 }
 
+void testExternalSort() {
+    std::mt19937 gen(42);
+    std::vector<int32_t> data(10000);
+    for (auto &x : data) {
+        x = gen();
+    }
+
+    std::string in = "/tmp/heap-test-extsort.in";
+    std::string out = "/tmp/heap-test-extsort.out";
+    std::ofstream(in, std::ios::binary).write(
+        reinterpret_cast<const char *>(data.data()), data.size() * sizeof(int32_t));
+
+    // a tiny memory budget forces many runs and several merge passes.
+    ExternalSort<int32_t> sorter(comp, 4096, "/tmp");
+    ExternalSortStats stats = sorter.sort(in, out);
+
+    std::vector<int32_t> sorted(data.size());
+    std::ifstream(out, std::ios::binary).read(
+        reinterpret_cast<char *>(sorted.data()), sorted.size() * sizeof(int32_t));
+    std::sort(data.begin(), data.end());
+
+    // replacement selection should make runs longer than the budget on average.
+    bool longRuns = stats.runs * 4096 < data.size() * sizeof(int32_t);
+    if (sorted == data && stats.runs > 1 && stats.mergePasses > 1 && longRuns) {
+        std::cout << "  external sort PASS" << std::endl;
+    } else {
+        std::cout << "  external sort FAIL" << std::endl;
+    }
+    std::remove(in.c_str());
+    std::remove(out.c_str());
+}
+
+void testExternalSortCleanup() {
+    // a partial record at the end makes the read fail after runs exist.
+    std::string in = "/tmp/heap-test-extsort-bad.in";
+    std::vector<char> bytes(10001, 7);
+    std::ofstream(in, std::ios::binary).write(bytes.data(), bytes.size());
+
+    ExternalSort<int32_t> sorter(comp, 4096, "/tmp");
+    bool threw = false;
+    try {
+        sorter.sort(in, "/tmp/heap-test-extsort-bad.out");
+    } catch (const std::runtime_error &) {
+        threw = true;
+    }
+    std::string firstRun = "/tmp/extsort-" + std::to_string(::getpid()) + "-0.run";
+    bool leftover = std::ifstream(firstRun).good();
+
+    if (threw && !leftover) {
+        std::cout << "  external sort cleanup PASS" << std::endl;
+    } else {
+        std::cout << "  external sort cleanup FAIL" << std::endl;
+    }
+    std::remove(in.c_str());
+}
+
 int main() {
     std::cout << "testing!" << std::endl;
     testConstruct();
@@ -75,11 +145,15 @@ int main() {
     testHeapifyNothing();
     std::cout << "second done" << std::endl;
     testHeapifySomething();
+    testHeapifyTwo();
     std::cout << "third done" << std::endl;
     testHeapSort();
     std::cout << "fourth done" << std::endl;
     testPriorityQueue();
     std::cout << "fifth done" << std::endl;
+    testExternalSort();
+    testExternalSortCleanup();
+    std::cout << "sixth done" << std::endl;
 
     return 0;
 }
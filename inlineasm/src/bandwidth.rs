@@ -0,0 +1,514 @@
+//! STREAM-style memory bandwidth and latency measurements.
+//!
+//! Bandwidth kernels run over a working set of a given total size split evenly
+//! between 1 or more threads, each pinned to its own CPU and touching only
+//! buffers it allocated itself. Bytes are counted the STREAM way: what the
+//! kernel asks to read plus what it asks to write, without write-allocate
+//! traffic. Latency is measured by chasing pointers around a random cycle of
+//! cache lines, so every load depends on the one before it.
+
+use std::fs;
+use std::hint::black_box;
+use std::sync::{Arc, Barrier};
+use std::thread;
+use std::time::{Duration, Instant};
+
+use shift::Kernel;
+use size::parse_size;
+
+/// A bandwidth kernel.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Op {
+    /// Sum an array.
+    Read,
+    /// Fill an array.
+    Write,
+    /// a = b
+    Copy,
+    /// a = b + s * c
+    Triad,
+    /// Fill an array with non-temporal stores.
+    NtWrite,
+    /// a = b with non-temporal stores.
+    NtCopy
+}
+
+impl Op {
+    pub fn all() -> Vec<Op> {
+        vec![Op::Read, Op::Write, Op::Copy, Op::Triad, Op::NtWrite, Op::NtCopy]
+    }
+
+    pub fn name(self) -> &'static str {
+        match self {
+            Op::Read => "read",
+            Op::Write => "write",
+            Op::Copy => "copy",
+            Op::Triad => "triad",
+            Op::NtWrite => "nt_write",
+            Op::NtCopy => "nt_copy"
+        }
+    }
+
+    pub fn from_name(name: &str) -> Option<Op> {
+        Op::all().into_iter().find(|op| op.name() == name)
+    }
+
+    /// The number of arrays the kernel touches.
+    pub fn arrays(self) -> usize {
+        match self {
+            Op::Read | Op::Write | Op::NtWrite => 1,
+            Op::Copy | Op::NtCopy => 2,
+            Op::Triad => 3
+        }
+    }
+}
+
+/// A cache level of CPU 0 as reported by sysfs.
+#[derive(Clone, Debug)]
+pub struct Cache {
+    pub level: u32,
+    pub bytes: usize,
+    /// How many CPUs share it.
+    pub shared_by: usize
+}
+
+/// The data and unified caches of CPU 0, smallest first. Empty where sysfs
+/// isn't available.
+pub fn caches() -> Vec<Cache> {
+    let mut found = vec![];
+    for i in 0..8 {
+        let dir = format!("/sys/devices/system/cpu/cpu0/cache/index{}", i);
+        let read = |f: &str| fs::read_to_string(format!("{}/{}", dir, f))
+                                .map(|s| s.trim().to_string()).ok();
+        match (read("level"), read("type"), read("size")) {
+            (Some(level), Some(kind), Some(size)) => {
+                if kind == "Instruction" {
+                    continue;
+                }
+                let shared_by = read("shared_cpu_list").map_or(1, |l| cpu_list(&l).len());
+                if let (Ok(level), Some(bytes)) = (level.parse(), parse_size(&size)) {
+                    found.push(Cache { level: level, bytes: bytes, shared_by: shared_by.max(1) });
+                }
+            }
+            _ => break
+        }
+    }
+    found.sort_by_key(|c| c.level);
+    found
+}
+
+/// Name the smallest cache a working set fits in, or DRAM, when it's spread
+/// evenly over cpus distinct CPUs. A private cache only holds one CPU's share
+/// of the working set, however many threads share that CPU.
+pub fn level_for(caches: &[Cache], bytes: usize, cpus: usize) -> String {
+    let cpus = cpus.max(1);
+    for c in caches {
+        // CPUs beyond the ones sharing a cache spread over more copies of it.
+        let share = bytes * cpus.min(c.shared_by) / cpus;
+        if share <= c.bytes {
+            return format!("L{}", c.level);
+        }
+    }
+    "DRAM".to_string()
+}
+
+// Parse a sysfs CPU list like "0-3,8,10-11".
+fn cpu_list(s: &str) -> Vec<usize> {
+    let mut cpus = vec![];
+    for part in s.split(',').filter(|p| !p.is_empty()) {
+        let mut ends = part.splitn(2, '-').map(|n| n.trim().parse::<usize>());
+        match (ends.next(), ends.next()) {
+            (Some(Ok(a)), None) => cpus.push(a),
+            (Some(Ok(a)), Some(Ok(b))) => cpus.extend(a..b + 1),
+            _ => {}
+        }
+    }
+    cpus
+}
+
+#[cfg(target_os = "linux")]
+mod affinity {
+    // cpu_set_t as glibc lays it out: 1024 bits.
+    type CpuSet = [u64; 16];
+
+    extern "C" {
+        fn sched_setaffinity(pid: i32, size: usize, mask: *const CpuSet) -> i32;
+        fn sched_getaffinity(pid: i32, size: usize, mask: *mut CpuSet) -> i32;
+    }
+
+    pub fn allowed() -> Vec<usize> {
+        let mut set: CpuSet = [0; 16];
+        if unsafe { sched_getaffinity(0, 128, &mut set) } != 0 {
+            return vec![];
+        }
+        (0..1024).filter(|&c| set[c / 64] & (1 << (c % 64)) != 0).collect()
+    }
+
+    pub fn pin(cpus: &[usize]) -> bool {
+        let mut set: CpuSet = [0; 16];
+        for &cpu in cpus {
+            if cpu >= 1024 {
+                return false;
+            }
+            set[cpu / 64] |= 1 << (cpu % 64);
+        }
+        !cpus.is_empty() && unsafe { sched_setaffinity(0, 128, &set) == 0 }
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+mod affinity {
+    pub fn allowed() -> Vec<usize> {
+        vec![]
+    }
+
+    pub fn pin(_cpus: &[usize]) -> bool {
+        false
+    }
+}
+
+/// The CPUs this process may run on, in order.
+pub fn allowed_cpus() -> Vec<usize> {
+    let cpus = affinity::allowed();
+    if cpus.is_empty() {
+        (0..thread::available_parallelism().map_or(1, |n| n.get())).collect()
+    } else {
+        cpus
+    }
+}
+
+/// Pin the calling thread to a CPU. Returns false if that isn't possible.
+pub fn pin_to_cpu(cpu: usize) -> bool {
+    affinity::pin(&[cpu])
+}
+
+/// Let the calling thread run on any of the given CPUs, such as the ones
+/// `allowed_cpus` returned before pinning. Returns false if that isn't possible.
+pub fn pin_to_cpus(cpus: &[usize]) -> bool {
+    affinity::pin(cpus)
+}
+
+/// The result of one bandwidth measurement.
+#[derive(Clone, Debug)]
+pub struct Bandwidth {
+    pub op: Op,
+    pub bytes: usize,
+    pub threads: usize,
+    /// Whether every thread was pinned to a CPU of its own.
+    pub pinned: bool,
+    /// The instruction set the kernel ran on.
+    pub kernel: Kernel,
+    /// Decimal gigabytes per second, the best of the trials.
+    pub gb_per_s: f64
+}
+
+/// Measure one kernel over a working set of bytes in total, split between
+/// threads pinned to the given CPUs in turn. Each trial moves about
+/// target_bytes and the fastest of trials trials is kept. With more threads
+/// than CPUs some share one, and the result doesn't count as pinned. The
+/// kernel uses the widest vectors this CPU has.
+pub fn bandwidth(op: Op, bytes: usize, threads: usize, cpus: &[usize], target_bytes: usize,
+                 trials: usize) -> Bandwidth {
+    let kernel = Kernel::best();
+    let words = (bytes / threads / op.arrays() / 8).max(8);
+    let moved = words * 8 * op.arrays();
+    let reps = (target_bytes / threads / moved).max(1);
+
+    // every trial starts with all threads at a barrier and each thread times
+    // its own reps, so a trial runs from the first start to the last end.
+    let barrier = Arc::new(Barrier::new(threads));
+    let mut pinned = threads <= cpus.len();
+    let mut spans: Vec<(Instant, Instant)> = vec![];
+    thread::scope(|s| {
+        let handles: Vec<_> = (0..threads).map(|t| {
+            let barrier = barrier.clone();
+            let cpu = if cpus.is_empty() { None } else { Some(cpus[t % cpus.len()]) };
+            s.spawn(move || {
+                let pinned = cpu.map_or(false, pin_to_cpu);
+                let mut a = vec![1.0f64; words];
+                let b = vec![2.0f64; if op.arrays() > 1 { words } else { 0 }];
+                let c = vec![0.5f64; if op.arrays() > 2 { words } else { 0 }];
+                let mut times = Vec::with_capacity(trials);
+                for _ in 0..trials {
+                    barrier.wait();
+                    let start = Instant::now();
+                    for _ in 0..reps {
+                        run(op, kernel, &mut a, &b, &c);
+                    }
+                    times.push((start, Instant::now()));
+                }
+                (pinned, times)
+            })
+        }).collect();
+
+        for h in handles {
+            let (p, times) = h.join().unwrap();
+            pinned &= p;
+            if spans.is_empty() {
+                spans = times;
+            } else {
+                for (span, time) in spans.iter_mut().zip(times) {
+                    *span = (span.0.min(time.0), span.1.max(time.1));
+                }
+            }
+        }
+    });
+
+    let best = spans.iter().map(|&(start, end)| seconds(end - start)).fold(f64::MAX, f64::min);
+    let total = (moved * reps * threads) as f64;
+    Bandwidth { op: op, bytes: moved * threads, threads: threads, pinned: pinned,
+                kernel: kernel, gb_per_s: total / best / 1e9 }
+}
+
+fn seconds(e: Duration) -> f64 {
+    e.as_secs() as f64 + e.subsec_nanos() as f64 * 1e-9
+}
+
+// Run a kernel once with the given instruction set, which must be supported.
+// Copies go from b into a; the triad reads b and c. Returns the sum for a read
+// and 0 otherwise.
+fn run(op: Op, kernel: Kernel, a: &mut [f64], b: &[f64], c: &[f64]) -> f64 {
+    #[cfg(target_arch = "x86_64")]
+    let sum = unsafe {
+        match kernel {
+            // SSE2 is part of baseline x86-64.
+            Kernel::Scalar => simd::sse2(op, a, b, c),
+            Kernel::Avx2 => simd::avx2(op, a, b, c),
+            Kernel::Avx512 => simd::avx512(op, a, b, c)
+        }
+    };
+    #[cfg(not(target_arch = "x86_64"))]
+    let sum = {
+        let _ = kernel;
+        portable(op, a, b, c)
+    };
+    black_box(a);
+    black_box(sum)
+}
+
+#[cfg(not(target_arch = "x86_64"))]
+fn portable(op: Op, a: &mut [f64], b: &[f64], c: &[f64]) -> f64 {
+    match op {
+        Op::Read => return a.iter().sum(),
+        Op::Write | Op::NtWrite => {
+            for x in a.iter_mut() {
+                *x = 3.0;
+            }
+        }
+        Op::Copy | Op::NtCopy => a.copy_from_slice(b),
+        Op::Triad => {
+            for ((x, &y), &z) in a.iter_mut().zip(b.iter()).zip(c.iter()) {
+                *x = y + 3.0 * z;
+            }
+        }
+    }
+    0.0
+}
+
+/// The kernels as explicit vector loops, one set per instruction set, so every
+/// op moves data at the same width. Leaving copy to `copy_from_slice` would hand
+/// it to the C library's memcpy, which picks its own width at runtime while the
+/// other ops compile for baseline x86-64. Stores go to aligned vectors of a,
+/// with scalar words on either side; b and c are loaded unaligned.
+#[cfg(target_arch = "x86_64")]
+mod simd {
+    use std::arch::x86_64::*;
+
+    use super::Op;
+
+    // Independent sums in the read loop. With loads issuing two a cycle and an
+    // add taking about 4, this many keeps the loop waiting on loads, not adds.
+    const ACCUMULATORS: usize = 8;
+
+    macro_rules! kernels {
+        ($name:ident, $feature:literal, $v:ty, $lanes:expr, $zero:ident, $set1:ident,
+         $load:ident, $loadu:ident, $store:ident, $storeu:ident, $stream:ident,
+         $add:ident, $mul:ident) => {
+            #[target_feature(enable = $feature)]
+            pub unsafe fn $name(op: Op, a: &mut [f64], b: &[f64], c: &[f64]) -> f64 {
+                const LANES: usize = $lanes;
+                let len = a.len();
+                let align = LANES * 8;
+                let head = ((align - a.as_ptr() as usize % align) % align / 8).min(len);
+                let body = head + (len - head) / LANES * LANES;
+                let pa = a.as_mut_ptr();
+                let (pb, pc) = (b.as_ptr(), c.as_ptr());
+                let mut sum = 0.0;
+
+                match op {
+                    Op::Read => {
+                        let mut acc: [$v; ACCUMULATORS] = [$zero(); ACCUMULATORS];
+                        let mut i = head;
+                        while i + ACCUMULATORS * LANES <= body {
+                            for j in 0..ACCUMULATORS {
+                                acc[j] = $add(acc[j], $load(pa.add(i + j * LANES)));
+                            }
+                            i += ACCUMULATORS * LANES;
+                        }
+                        while i < body {
+                            acc[0] = $add(acc[0], $load(pa.add(i)));
+                            i += LANES;
+                        }
+                        sum = a[..head].iter().chain(a[body..].iter()).sum();
+                        let mut lanes = [0.0f64; LANES];
+                        for v in acc.iter() {
+                            $storeu(lanes.as_mut_ptr(), *v);
+                            sum += lanes.iter().sum::<f64>();
+                        }
+                    }
+                    Op::Write | Op::NtWrite => {
+                        for i in (0..head).chain(body..len) {
+                            a[i] = 3.0;
+                        }
+                        let v = $set1(3.0);
+                        let mut i = head;
+                        while i < body {
+                            if op == Op::NtWrite {
+                                $stream(pa.add(i), v);
+                            } else {
+                                $store(pa.add(i), v);
+                            }
+                            i += LANES;
+                        }
+                    }
+                    Op::Copy | Op::NtCopy => {
+                        for i in (0..head).chain(body..len) {
+                            a[i] = b[i];
+                        }
+                        let mut i = head;
+                        while i < body {
+                            let v = $loadu(pb.add(i));
+                            if op == Op::NtCopy {
+                                $stream(pa.add(i), v);
+                            } else {
+                                $store(pa.add(i), v);
+                            }
+                            i += LANES;
+                        }
+                    }
+                    Op::Triad => {
+                        for i in (0..head).chain(body..len) {
+                            a[i] = b[i] + 3.0 * c[i];
+                        }
+                        let s = $set1(3.0);
+                        let mut i = head;
+                        while i < body {
+                            $store(pa.add(i), $add($loadu(pb.add(i)), $mul(s, $loadu(pc.add(i)))));
+                            i += LANES;
+                        }
+                    }
+                }
+                if op == Op::NtWrite || op == Op::NtCopy {
+                    _mm_sfence();
+                }
+                sum
+            }
+        }
+    }
+
+    kernels!(sse2, "sse2", __m128d, 2, _mm_setzero_pd, _mm_set1_pd, _mm_load_pd, _mm_loadu_pd,
+             _mm_store_pd, _mm_storeu_pd, _mm_stream_pd, _mm_add_pd, _mm_mul_pd);
+    kernels!(avx2, "avx2", __m256d, 4, _mm256_setzero_pd, _mm256_set1_pd, _mm256_load_pd,
+             _mm256_loadu_pd, _mm256_store_pd, _mm256_storeu_pd, _mm256_stream_pd,
+             _mm256_add_pd, _mm256_mul_pd);
+    kernels!(avx512, "avx512f", __m512d, 8, _mm512_setzero_pd, _mm512_set1_pd, _mm512_load_pd,
+             _mm512_loadu_pd, _mm512_store_pd, _mm512_storeu_pd, _mm512_stream_pd,
+             _mm512_add_pd, _mm512_mul_pd);
+}
+
+/// The average nanoseconds per load when chasing pointers around a random
+/// cycle through every cache line of a bytes sized buffer, from one thread.
+pub fn latency_ns(bytes: usize, loads: usize) -> f64 {
+    const LINE_WORDS: usize = 8;
+    let lines = (bytes / 64).max(2);
+
+    // Sattolo's algorithm gives a single cycle through all the lines.
+    let mut order: Vec<usize> = (0..lines).collect();
+    let mut seed = 0x9E3779B97F4A7C15u64;
+    for i in (1..lines).rev() {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        order.swap(i, (seed % i as u64) as usize);
+    }
+    let mut next = vec![0usize; lines * LINE_WORDS];
+    for i in 0..lines {
+        next[i * LINE_WORDS] = order[i] * LINE_WORDS;
+    }
+
+    // one lap to warm the caches and TLB, then the timed loads.
+    let mut p = 0;
+    for _ in 0..lines {
+        p = next[p];
+    }
+    let start = Instant::now();
+    for _ in 0..loads {
+        p = next[p];
+    }
+    let elapsed = seconds(start.elapsed());
+    black_box(p);
+    elapsed * 1e9 / loads as f64
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_kernels() {
+        let kernels = [Kernel::Scalar, Kernel::Avx2, Kernel::Avx512];
+        for &kernel in kernels.iter().filter(|k| k.is_supported()) {
+            for &len in [0, 1, 2, 7, 100].iter() {
+                for &op in Op::all().iter() {
+                    // start one word in so the aligned part doesn't begin at a[0].
+                    let mut storage = vec![1.0; len + 1];
+                    let a = &mut storage[1..];
+                    let b: Vec<f64> = (0..len).map(|i| i as f64).collect();
+                    let c = vec![0.5; len];
+                    let sum = run(op, kernel, a, &b, &c);
+                    if op == Op::Read {
+                        assert_eq!(sum, len as f64, "{:?} len {}", kernel, len);
+                    }
+                    let expected: Vec<f64> = match op {
+                        Op::Read => vec![1.0; len],
+                        Op::Write | Op::NtWrite => vec![3.0; len],
+                        Op::Copy | Op::NtCopy => b.clone(),
+                        Op::Triad => b.iter().map(|&y| y + 1.5).collect()
+                    };
+                    assert_eq!(a, &expected[..], "{:?} {:?} len {}", kernel, op, len);
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_cpu_list() {
+        assert_eq!(cpu_list("0-3,8,10-11"), [0, 1, 2, 3, 8, 10, 11]);
+        assert_eq!(cpu_list("5"), [5]);
+        assert!(cpu_list("").is_empty());
+    }
+
+    #[test]
+    fn test_level_for() {
+        let caches = vec![Cache { level: 1, bytes: 32 << 10, shared_by: 1 },
+                          Cache { level: 2, bytes: 1 << 20, shared_by: 1 },
+                          Cache { level: 3, bytes: 32 << 20, shared_by: 8 }];
+        assert_eq!(level_for(&caches, 16 << 10, 1), "L1");
+        assert_eq!(level_for(&caches, 64 << 10, 4), "L1");
+        assert_eq!(level_for(&caches, 64 << 10, 1), "L2");
+        assert_eq!(level_for(&caches, 16 << 20, 2), "L3");
+        assert_eq!(level_for(&caches, 1 << 30, 8), "DRAM");
+    }
+
+    #[test]
+    fn test_measurements_run() {
+        let cpus = allowed_cpus();
+        for &op in Op::all().iter() {
+            let r = bandwidth(op, 64 << 10, 2, &cpus, 1 << 20, 2);
+            assert!(r.gb_per_s > 0.0 && r.gb_per_s.is_finite(), "{:?}", r);
+        }
+        // threads beyond the allowed CPUs have to share one.
+        assert!(!bandwidth(Op::Read, 64 << 10, cpus.len() + 1, &cpus, 1 << 20, 1).pinned);
+        assert!(latency_ns(64 << 10, 10000) > 0.0);
+    }
+}
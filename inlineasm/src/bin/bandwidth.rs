@@ -0,0 +1,139 @@
+//! Sweep memory bandwidth and latency across cache levels and thread counts.
+//!
+//! Usage: bandwidth [--json] [--min SIZE] [--max SIZE] [--threads N]
+//!                  [--ops read,write,copy,triad,nt_write,nt_copy] [--no-latency]
+//!
+//! Sizes take K, M or G suffixes. Working sets double from --min to --max, and
+//! thread counts double from 1 up to --threads (default: every allowed CPU),
+//! always ending on the maximum. Build with --release.
+
+extern crate inlineasm;
+
+use std::env;
+use std::process;
+
+use inlineasm::bandwidth::{self, Op};
+use inlineasm::size;
+
+struct Row {
+    kind: &'static str,
+    op: &'static str,
+    bytes: usize,
+    threads: usize,
+    level: String,
+    pinned: bool,
+    gb_per_s: Option<f64>,
+    latency_ns: Option<f64>
+}
+
+fn parse_bytes(s: &str) -> usize {
+    size::parse_size(s).unwrap_or_else(|| usage())
+}
+
+fn usage() -> ! {
+    eprintln!("usage: bandwidth [--json] [--min SIZE] [--max SIZE] [--threads N] \
+               [--ops read,write,copy,triad,nt_write,nt_copy] [--no-latency]");
+    process::exit(2)
+}
+
+fn opt(v: Option<f64>, digits: usize) -> String {
+    v.map_or(String::new(), |x| format!("{:.*}", digits, x))
+}
+
+fn json_opt(v: Option<f64>, digits: usize) -> String {
+    v.map_or("null".to_string(), |x| format!("{:.*}", digits, x))
+}
+
+fn main() {
+    let cpus = bandwidth::allowed_cpus();
+    let mut json = false;
+    let mut min = 16 << 10;
+    let mut max = 1 << 30;
+    let mut max_threads = cpus.len();
+    let mut ops = Op::all();
+    let mut latency = true;
+
+    let args: Vec<String> = env::args().skip(1).collect();
+    let mut i = 0;
+    while i < args.len() {
+        let value = || args.get(i + 1).map(|s| s.as_str()).unwrap_or_else(|| usage());
+        match args[i].as_str() {
+            "--json" => json = true,
+            "--no-latency" => latency = false,
+            "--min" => { min = parse_bytes(value()); i += 1; }
+            "--max" => { max = parse_bytes(value()); i += 1; }
+            "--threads" => { max_threads = value().parse().unwrap_or_else(|_| usage()); i += 1; }
+            "--ops" => {
+                ops = value().split(',').map(|n| Op::from_name(n).unwrap_or_else(|| usage()))
+                             .collect();
+                i += 1;
+            }
+            _ => usage()
+        }
+        i += 1;
+    }
+
+    let mut sizes = vec![];
+    let mut size = min.max(4 << 10);
+    while size <= max {
+        sizes.push(size);
+        size *= 2;
+    }
+    let mut thread_counts = vec![];
+    let mut t = 1;
+    while t < max_threads {
+        thread_counts.push(t);
+        t *= 2;
+    }
+    thread_counts.push(max_threads.max(1));
+
+    let caches = bandwidth::caches();
+    let mut rows = vec![];
+    for &bytes in sizes.iter() {
+        if latency {
+            // pointer chasing is one thread by nature; pin it like the rest,
+            // then let this thread go again so it doesn't sit on worker 0's CPU.
+            let pinned = bandwidth::pin_to_cpu(cpus[0]);
+            let ns = bandwidth::latency_ns(bytes, 1 << 22);
+            bandwidth::pin_to_cpus(&cpus);
+            rows.push(Row { kind: "latency", op: "chase", bytes: bytes, threads: 1,
+                            level: bandwidth::level_for(&caches, bytes, 1), pinned: pinned,
+                            gb_per_s: None, latency_ns: Some(ns) });
+        }
+        for &threads in thread_counts.iter() {
+            for &op in ops.iter() {
+                let r = bandwidth::bandwidth(op, bytes, threads, &cpus, 1 << 30, 3);
+                rows.push(Row { kind: "bandwidth", op: op.name(), bytes: r.bytes,
+                                threads: threads,
+                                level: bandwidth::level_for(&caches, r.bytes,
+                                                            threads.min(cpus.len())),
+                                pinned: r.pinned, gb_per_s: Some(r.gb_per_s),
+                                latency_ns: None });
+            }
+        }
+        eprintln!("done {} bytes", bytes);
+    }
+
+    if json {
+        println!("{{\"caches\": [{}],", caches.iter().map(|c| {
+            format!("{{\"level\": {}, \"bytes\": {}, \"shared_by\": {}}}",
+                    c.level, c.bytes, c.shared_by)
+        }).collect::<Vec<_>>().join(", "));
+        println!(" \"results\": [");
+        for (i, r) in rows.iter().enumerate() {
+            println!("  {{\"kind\": \"{}\", \"op\": \"{}\", \"working_set_bytes\": {}, \
+                      \"threads\": {}, \"level\": \"{}\", \"pinned\": {}, \
+                      \"gb_per_s\": {}, \"latency_ns\": {}}}{}",
+                     r.kind, r.op, r.bytes, r.threads, r.level, r.pinned,
+                     json_opt(r.gb_per_s, 3), json_opt(r.latency_ns, 2),
+                     if i + 1 < rows.len() { "," } else { "" });
+        }
+        println!(" ]}}");
+    } else {
+        println!("kind,op,working_set_bytes,threads,level,pinned,gb_per_s,latency_ns");
+        for r in rows.iter() {
+            println!("{},{},{},{},{},{},{},{}", r.kind, r.op, r.bytes, r.threads, r.level,
+                     r.pinned, opt(r.gb_per_s, 3), opt(r.latency_ns, 2));
+        }
+    }
+}
@@ -1,11 +1,18 @@
-#![feature(test)]
-#![feature(asm)]
+#![cfg_attr(feature = "nightly", feature(test))]
 
+#[cfg(all(test, feature = "nightly"))]
 extern crate test;
 
 use std::ops::ShrAssign;
+#[cfg(any(target_arch = "x86_64"))]
+use std::arch::asm;
+
+pub mod bandwidth;
+pub mod shift;
+pub mod size;
 
 
+#[cfg_attr(not(all(test, feature = "nightly")), allow(dead_code))]
 fn shift_all<T: ShrAssign<T> + Copy>(data: &mut[T], shft: T) {
     for d in data {
         *d >>= shft;
@@ -18,17 +25,16 @@ fn shift_all<T: ShrAssign<T> + Copy>(data: &mut[T], shft: T) {
 pub fn point_asm(data: &mut [u64]) {
     unsafe {
         let ptr = data.as_ptr();
-        let mut i: u64 = 0;
-        asm!(r#"movq $1, $0
-                addq $2, $0
-                1:
-                subq $$8, $0
-                cmpq $0, $1
-                jne 1b"#
-             : "=&r"(i)
-             : "r"(ptr), "r"(8*data.len() - 8)
-             : "memory", "cc"
-            );
+        asm!("movq {ptr}, {i}",
+             "addq {len}, {i}",
+             "2:",
+             "subq $8, {i}",
+             "cmpq {i}, {ptr}",
+             "jne 2b",
+             i = out(reg) _,
+             ptr = in(reg) ptr,
+             len = in(reg) 8*data.len() - 8,
+             options(att_syntax, nostack));
     }
 }
 
@@ -38,19 +44,18 @@ pub fn point_asm(data: &mut [u64]) {
 pub fn read_asm(data: &mut [u64]) {
     unsafe {
         let ptr = data.as_ptr();
-        let mut i: u64 = 0;
-        let mut tmp: u64 = 0;
-        asm!(r#"movq $2, $0
-                addq $3, $0
-                1:
-                subq $$8, $0
-                movq ($0), $1
-                cmpq $0, $2
-                jne 1b"#
-             : "=&r"(i), "=&r"(tmp)
-             : "r"(ptr), "r"(8*data.len())
-             : "memory", "cc"
-            );
+        asm!("movq {ptr}, {i}",
+             "addq {len}, {i}",
+             "2:",
+             "subq $8, {i}",
+             "movq ({i}), {tmp}",
+             "cmpq {i}, {ptr}",
+             "jne 2b",
+             i = out(reg) _,
+             tmp = out(reg) _,
+             ptr = in(reg) ptr,
+             len = in(reg) 8*data.len(),
+             options(att_syntax, nostack));
     }
 }
 
@@ -59,21 +64,20 @@ pub fn read_asm(data: &mut [u64]) {
 #[no_mangle]
 pub fn read_write_asm(data: &mut [u64]) {
     unsafe {
-        let ptr = data.as_ptr();
-        let mut i: u64 = 0;
-        let mut tmp: u64 = 0;
-        asm!(r#"movq $2, $0
-                addq $3, $0
-                1:
-                subq $$8, $0
-                movq ($0), $1
-                movq $1, ($0)
-                cmpq $0, $2
-                jne 1b"#
-             : "=&r"(i), "=&r"(tmp)
-             : "r"(ptr), "r"(8*data.len())
-             : "memory", "cc"
-            );
+        let ptr = data.as_mut_ptr();
+        asm!("movq {ptr}, {i}",
+             "addq {len}, {i}",
+             "2:",
+             "subq $8, {i}",
+             "movq ({i}), {tmp}",
+             "movq {tmp}, ({i})",
+             "cmpq {i}, {ptr}",
+             "jne 2b",
+             i = out(reg) _,
+             tmp = out(reg) _,
+             ptr = in(reg) ptr,
+             len = in(reg) 8*data.len(),
+             options(att_syntax, nostack));
     }
 }
 
@@ -85,146 +89,200 @@ pub fn read_write_asm_unrolled(data: &mut [u64]) {
     // Unroll the loop to try to get the CPU to parallelize instructions.
     // Didn't make any difference on my Core 2 era Xeon.
     unsafe {
-        let ptr = data.as_ptr();
-        let mut i: u64 = 0;
-        let mut t1: u64 = 0;
-        let mut t2: u64 = 0;
-        let mut t3: u64 = 0;
-        let mut t4: u64 = 0;
-        asm!(r#"movq $5, $0
-                addq $6, $0
-
-                1:
-                subq $$32, $0
-
-                movq ($0), $1
-                movq 8($0), $2
-                movq 16($0), $3
-                movq 24($0), $4
-
-                movq $1, ($0)
-                movq $2, 8($0)
-                movq $3, 16($0)
-                movq $4, 24($0)
-
-                cmpq $0, $5
-                jne 1b"#
-             : "=&r"(i), "=&r"(t1), "=&r"(t2), "=&r"(t3), "=&r"(t4)
-             : "r"(ptr), "r"(8*data.len())
-             : "memory", "cc"
-            );
+        let ptr = data.as_mut_ptr();
+        asm!("movq {ptr}, {i}",
+             "addq {len}, {i}",
+
+             "2:",
+             "subq $32, {i}",
+
+             "movq ({i}), {t1}",
+             "movq 8({i}), {t2}",
+             "movq 16({i}), {t3}",
+             "movq 24({i}), {t4}",
+
+             "movq {t1}, ({i})",
+             "movq {t2}, 8({i})",
+             "movq {t3}, 16({i})",
+             "movq {t4}, 24({i})",
+
+             "cmpq {i}, {ptr}",
+             "jne 2b",
+             i = out(reg) _,
+             t1 = out(reg) _,
+             t2 = out(reg) _,
+             t3 = out(reg) _,
+             t4 = out(reg) _,
+             ptr = in(reg) ptr,
+             len = in(reg) 8*data.len(),
+             options(att_syntax, nostack));
     }
 }
 
 /// Performs an in place right bitshift on an arbitrarily sized &mut [u64].
-/// The shift amount must be at most 31.
+/// The shift amount must be at most 31. See the shift module for any amount.
 #[cfg(any(target_arch = "x86_64"))]
 #[no_mangle]
 pub fn shift_asm(data: &mut [u64], shift: u8) {
     unsafe {
-        let ptr = data.as_ptr();
-        let mut i: u64 = 0;
-        let mut tmp: u64 = 0;
-        asm!(r#"movq $2, $0
-                addq $4, $0
-                1:
-                subq $$8, $0
-                movq ($0), $1
-                shrd $1, 8($0)
-                cmpq $2, $0
-                jne 1b
-                movq $$0, $1
-                shrd $1, ($2)"#
-            : "=&r"(i), "=&r"(tmp)
-            : "r"(ptr), "{cl}"(shift), "r"(8*data.len() - 8)
-            : "memory", "cc"
-            );
+        let ptr = data.as_mut_ptr();
+        asm!("movq {ptr}, {i}",
+             "addq {len}, {i}",
+             "2:",
+             "subq $8, {i}",
+             "movq ({i}), {tmp}",
+             "shrdq %cl, {tmp}, 8({i})",
+             "cmpq {ptr}, {i}",
+             "jne 2b",
+             "movq $0, {tmp}",
+             "shrdq %cl, {tmp}, ({ptr})",
+             i = out(reg) _,
+             tmp = out(reg) _,
+             ptr = in(reg) ptr,
+             len = in(reg) 8*data.len() - 8,
+             in("cl") shift,
+             options(att_syntax, nostack));
     }
 }
 
 #[cfg(test)]
-mod tests {
-    use super::*;
-    use test::Bencher;
+const TEST_BYTES: usize = 100_000_000;
 
-    const test_bytes: usize = 100_000_000;
+#[cfg(test)]
+mod tests {
+    use super::TEST_BYTES;
 
     #[test]
     fn test_shift_asm() {
         let input = 0x10000000_00000001_u64;
         let expected_first = 0x00200000_00000000_u64;
         let expected_rest = 0x02200000_00000000_u64;
-        let mut v = vec![input; test_bytes/8];
+        let mut v = vec![input; TEST_BYTES/8];
         super::shift_asm(&mut v[..], 7);
         assert_eq!(v[0], expected_first);
         assert_eq!(v[1], expected_rest);
         assert_eq!(v[100], expected_rest);
         assert_eq!(v[1000], expected_rest);
-        assert_eq!(v[test_bytes/8-1], expected_rest);
+        assert_eq!(v[TEST_BYTES/8-1], expected_rest);
     }
+}
+
+// The benches need the unstable test crate: cargo +nightly bench --features nightly
+#[cfg(all(test, feature = "nightly"))]
+mod benches {
+    use super::*;
+    use test::Bencher;
 
     #[bench]
     fn bench_point_asm(b: &mut Bencher) {
         let input = 0x10000000_00000001_u64;
-        let mut v = vec![input; test_bytes/8];
+        let mut v = vec![input; TEST_BYTES/8];
         b.iter(|| super::point_asm(&mut v[..]));
     }
 
     #[bench]
     fn bench_read_asm(b: &mut Bencher) {
         let input = 0x10000000_00000001_u64;
-        let mut v = vec![input; test_bytes/8];
+        let mut v = vec![input; TEST_BYTES/8];
         b.iter(|| super::read_asm(&mut v[..]));
     }
 
     #[bench]
     fn bench_read_write_asm(b: &mut Bencher) {
         let input = 0x10000000_00000001_u64;
-        let mut v = vec![input; test_bytes/8];
+        let mut v = vec![input; TEST_BYTES/8];
         b.iter(|| super::read_write_asm(&mut v[..]));
     }
     #[bench]
 
     fn bench_read_write_asm_unrolled(b: &mut Bencher) {
         let input = 0x10000000_00000001_u64;
-        let mut v = vec![input; test_bytes/8];
+        let mut v = vec![input; TEST_BYTES/8];
         b.iter(|| super::read_write_asm_unrolled(&mut v[..]));
     }
 
     #[bench]
     fn bench_shift_asm(b: &mut Bencher) {
         let input = 0x10000000_00000001_u64;
-        let mut v = vec![input; test_bytes/8];
+        let mut v = vec![input; TEST_BYTES/8];
         b.iter(|| super::shift_asm(&mut v[..], 7));
     }
 
+    // Throughput of the shift kernel by buffer size and thread count. The sizes
+    // run from inside L2 to well past the last level cache, where the
+    // non-temporal stores kick in. MB/s comes from the bytes per iteration.
+    macro_rules! bench_shifter {
+        ($($name:ident: $bytes:expr, $threads:expr, $shift:expr;)*) => {$(
+            #[bench]
+            fn $name(b: &mut Bencher) {
+                let mut v = vec![0x10000000_00000001_u64; $bytes / 8];
+                let s = shift::Shifter::new().threads($threads);
+                b.bytes = $bytes as u64;
+                b.iter(|| s.right(&mut v[..], $shift));
+            }
+        )*}
+    }
+
+    bench_shifter! {
+        bench_shifter_1mb_1t: 1 << 20, 1, 7;
+        bench_shifter_16mb_1t: 16 << 20, 1, 7;
+        bench_shifter_100mb_1t: TEST_BYTES, 1, 7;
+        bench_shifter_1gb_1t: 1 << 30, 1, 7;
+        bench_shifter_16mb_2t: 16 << 20, 2, 7;
+        bench_shifter_100mb_2t: TEST_BYTES, 2, 7;
+        bench_shifter_1gb_2t: 1 << 30, 2, 7;
+        bench_shifter_16mb_4t: 16 << 20, 4, 7;
+        bench_shifter_100mb_4t: TEST_BYTES, 4, 7;
+        bench_shifter_1gb_4t: 1 << 30, 4, 7;
+        bench_shifter_100mb_8t: TEST_BYTES, 8, 7;
+        bench_shifter_1gb_8t: 1 << 30, 8, 7;
+        bench_shifter_100mb_1t_words: TEST_BYTES, 1, 64 * 3 + 7;
+        bench_shifter_100mb_4t_words: TEST_BYTES, 4, 64 * 3 + 7;
+    }
+
+    #[bench]
+    fn bench_shifter_100mb_scalar(b: &mut Bencher) {
+        let mut v = vec![0x10000000_00000001_u64; TEST_BYTES / 8];
+        let s = shift::Shifter::new().kernel(shift::Kernel::Scalar);
+        b.bytes = TEST_BYTES as u64;
+        b.iter(|| s.right(&mut v[..], 7));
+    }
+
+    #[bench]
+    fn bench_shifter_100mb_left(b: &mut Bencher) {
+        let mut v = vec![0x10000000_00000001_u64; TEST_BYTES / 8];
+        let s = shift::Shifter::new();
+        b.bytes = TEST_BYTES as u64;
+        b.iter(|| s.left(&mut v[..], 7));
+    }
+
     #[bench]
     fn bench_u8_shift(b: &mut Bencher) {
-        let mut data = vec![0xCC_u8; test_bytes];
+        let mut data = vec![0xCC_u8; TEST_BYTES];
         b.iter(|| super::shift_all(&mut data, 7));
     }
 
     #[bench]
     fn bench_u16_shift(b: &mut Bencher) {
-        let mut data = vec![0xCC_CC_u16; test_bytes/2];
+        let mut data = vec![0xCC_CC_u16; TEST_BYTES/2];
         b.iter(|| super::shift_all(&mut data, 7));
     }
 
     #[bench]
     fn bench_u32_shift(b: &mut Bencher) {
-        let mut data = vec![0xCC_CC_CC_CC_u32; test_bytes/4];
+        let mut data = vec![0xCC_CC_CC_CC_u32; TEST_BYTES/4];
         b.iter(|| super::shift_all(&mut data, 7));
     }
 
     #[bench]
     fn bench_u64_shift(b: &mut Bencher) {
-        let mut data = vec![0xCC_CC_CC_CC_CC_CC_CC_CC_u64; test_bytes/8];
+        let mut data = vec![0xCC_CC_CC_CC_CC_CC_CC_CC_u64; TEST_BYTES/8];
         b.iter(|| super::shift_all(&mut data, 7));
     }
 
     #[bench]
     fn bench_usize_shift(b: &mut Bencher) {
-        let mut data = vec![0xCC_CC_CC_CC_CC_CC_CC_CC_usize; test_bytes/8]; // 8 for 64-bit
+        let mut data = vec![0xCC_CC_CC_CC_CC_CC_CC_CC_usize; TEST_BYTES/8]; // 8 for 64-bit
         b.iter(|| super::shift_all(&mut data, 7));
     }
 
@@ -0,0 +1,570 @@
+//! Bit shifts of arbitrarily long `&mut [u64]` buffers.
+//!
+//! The buffer is treated as one big number with `data[0]` as its most
+//! significant word, the same as `shift_asm`: a right shift moves bits towards
+//! the end of the slice and fills the front with zeros, a left shift moves them
+//! towards the front and fills the end with zeros. Any shift amount works,
+//! including whole-word moves and shifts past the end of the buffer.
+//!
+//! Shifting is memory bound (see the README), so the kernels are about moving
+//! bytes: AVX2 or AVX-512 when the CPU has them, non-temporal stores when the
+//! buffer won't fit in the last level cache anyway, and several threads to get
+//! more of the memory bandwidth than one core can pull.
+
+use std::fs;
+use std::sync::OnceLock;
+use std::thread;
+
+use size::parse_size;
+
+/// The instruction set a shift or bandwidth kernel runs on.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Kernel {
+    Scalar,
+    Avx2,
+    Avx512
+}
+
+impl Kernel {
+    /// The widest kernel this CPU supports.
+    pub fn best() -> Kernel {
+        if Kernel::Avx512.is_supported() {
+            Kernel::Avx512
+        } else if Kernel::Avx2.is_supported() {
+            Kernel::Avx2
+        } else {
+            Kernel::Scalar
+        }
+    }
+
+    pub fn is_supported(self) -> bool {
+        match self {
+            Kernel::Scalar => true,
+            #[cfg(target_arch = "x86_64")]
+            Kernel::Avx2 => is_x86_feature_detected!("avx2"),
+            #[cfg(target_arch = "x86_64")]
+            Kernel::Avx512 => is_x86_feature_detected!("avx512f"),
+            #[cfg(not(target_arch = "x86_64"))]
+            _ => false
+        }
+    }
+}
+
+/// The size of the last level cache in bytes, read from sysfs on Linux and
+/// guessed elsewhere.
+pub fn llc_bytes() -> usize {
+    static LLC: OnceLock<usize> = OnceLock::new();
+    *LLC.get_or_init(|| {
+        (0..8).rev()
+              .filter_map(|i| fs::read_to_string(
+                  format!("/sys/devices/system/cpu/cpu0/cache/index{}/size", i)).ok())
+              .filter_map(|s| parse_size(s.trim()))
+              .next()
+              .unwrap_or(32 << 20)
+    })
+}
+
+/// Settings for a shift. `Shifter::new()` picks the best kernel, one thread,
+/// and non-temporal stores for buffers bigger than the last level cache. The
+/// fields are private so the kernel can only be set through `kernel()`, which
+/// checks the CPU supports it before any SIMD code runs.
+#[derive(Clone, Copy, Debug)]
+pub struct Shifter {
+    kernel: Kernel,
+    threads: usize,
+    // buffers of more bytes than this are written with non-temporal stores.
+    non_temporal_above: usize
+}
+
+/// Each thread gets at least this many words, so small buffers aren't split
+/// into pieces that cost more to hand out than to shift.
+const MIN_CHUNK: usize = 1 << 16;
+
+impl Shifter {
+    pub fn new() -> Shifter {
+        Shifter { kernel: Kernel::best(), threads: 1, non_temporal_above: llc_bytes() }
+    }
+
+    /// Use the given kernel. Panics if this CPU doesn't support it.
+    pub fn kernel(mut self, kernel: Kernel) -> Shifter {
+        assert!(kernel.is_supported(), "{:?} is not supported on this CPU", kernel);
+        self.kernel = kernel;
+        self
+    }
+
+    pub fn threads(mut self, threads: usize) -> Shifter {
+        self.threads = threads.max(1);
+        self
+    }
+
+    /// Write buffers of more than bytes bytes with non-temporal stores.
+    pub fn non_temporal_above(mut self, bytes: usize) -> Shifter {
+        self.non_temporal_above = bytes;
+        self
+    }
+
+    /// Shift right by shift bits, towards the end of the slice.
+    pub fn right(&self, data: &mut [u64], shift: usize) {
+        let len = data.len();
+        let (words, bits) = (shift / 64, (shift % 64) as u32);
+        if words >= len {
+            fill(data, 0);
+            return;
+        }
+        let nt = len * 8 > self.non_temporal_above;
+        let chunks = self.chunks(data);
+        if chunks.len() == 1 {
+            right_kernel(self.kernel, data, &[], words, bits, nt);
+            return;
+        }
+
+        // each chunk reads the words + 1 words before it, which the threads
+        // below may overwrite first, so copy them out before starting. When that
+        // would copy more than a chunk per thread, do the whole word part of
+        // the move up front instead.
+        let (words, carry) = if words + 1 <= chunks[0] {
+            (words, words + 1)
+        } else {
+            data.copy_within(0..len - words, words);
+            fill(&mut data[..words], 0);
+            (0, 1)
+        };
+        let mut befores = vec![];
+        let mut start = 0;
+        for &size in chunks.iter() {
+            befores.push(data[start - carry.min(start)..start].to_vec());
+            start += size;
+        }
+
+        thread::scope(|s| {
+            let mut rest = &mut *data;
+            for (&size, before) in chunks.iter().zip(befores.iter()) {
+                let (chunk, tail) = rest.split_at_mut(size);
+                rest = tail;
+                let kernel = self.kernel;
+                s.spawn(move || right_kernel(kernel, chunk, before, words, bits, nt));
+            }
+        });
+    }
+
+    /// Shift left by shift bits, towards the front of the slice.
+    pub fn left(&self, data: &mut [u64], shift: usize) {
+        let len = data.len();
+        let (words, bits) = (shift / 64, (shift % 64) as u32);
+        if words >= len {
+            fill(data, 0);
+            return;
+        }
+        let nt = len * 8 > self.non_temporal_above;
+        let chunks = self.chunks(data);
+        if chunks.len() == 1 {
+            left_kernel(self.kernel, data, &[], words, bits, nt);
+            return;
+        }
+
+        // mirror image of right: each chunk reads the words + 1 words after it.
+        let (words, carry) = if words + 1 <= *chunks.last().unwrap() {
+            (words, words + 1)
+        } else {
+            data.copy_within(words..len, 0);
+            fill(&mut data[len - words..], 0);
+            (0, 1)
+        };
+        let mut afters = vec![];
+        let mut end = 0;
+        for &size in chunks.iter() {
+            end += size;
+            afters.push(data[end..(end + carry).min(len)].to_vec());
+        }
+
+        thread::scope(|s| {
+            let mut rest = &mut *data;
+            for (&size, after) in chunks.iter().zip(afters.iter()) {
+                let (chunk, tail) = rest.split_at_mut(size);
+                rest = tail;
+                let kernel = self.kernel;
+                s.spawn(move || left_kernel(kernel, chunk, after, words, bits, nt));
+            }
+        });
+    }
+
+    // Split data into per-thread chunk sizes whose inner boundaries fall on
+    // cache lines, so threads don't share a line at the seams.
+    fn chunks(&self, data: &[u64]) -> Vec<usize> {
+        let len = data.len();
+        let threads = self.threads.min(len / MIN_CHUNK).max(1);
+        let mut chunks = vec![];
+        let mut start = 0;
+        for t in 1..threads {
+            let end = align_up(data, len / threads * t, 8);
+            chunks.push(end - start);
+            start = end;
+        }
+        chunks.push(len - start);
+        chunks
+    }
+}
+
+/// Shift right by shift bits using `Shifter::new()`.
+pub fn shift_right(data: &mut [u64], shift: usize) {
+    Shifter::new().right(data, shift)
+}
+
+/// Shift left by shift bits using `Shifter::new()`.
+pub fn shift_left(data: &mut [u64], shift: usize) {
+    Shifter::new().left(data, shift)
+}
+
+fn fill(data: &mut [u64], value: u64) {
+    for d in data {
+        *d = value;
+    }
+}
+
+// hi's bits moved right by b, with the vacated top filled from lo.
+#[inline(always)]
+fn funnel_right(hi: u64, lo: u64, b: u32) -> u64 {
+    if b == 0 { hi } else { (hi >> b) | (lo << (64 - b)) }
+}
+
+// lo's bits moved left by b, with the vacated bottom filled from hi.
+#[inline(always)]
+fn funnel_left(lo: u64, hi: u64, b: u32) -> u64 {
+    if b == 0 { lo } else { (lo << b) | (hi >> (64 - b)) }
+}
+
+// The number of u64 lanes per vector of a kernel.
+fn lanes(kernel: Kernel) -> usize {
+    match kernel {
+        Kernel::Scalar => 0,
+        Kernel::Avx2 => 4,
+        Kernel::Avx512 => 8
+    }
+}
+
+// The index of the first word at or after i that starts a vector sized and
+// aligned block.
+fn align_up(data: &[u64], i: usize, lanes: usize) -> usize {
+    let word = data.as_ptr() as usize / 8 + i;
+    i + (lanes - word % lanes) % lanes
+}
+
+// Right shift data in place by w words and b bits. before holds the words that
+// precede data[0] in the source, the last one adjacent; anything earlier is 0.
+// Works from the end down so each source word is read before it's overwritten.
+fn right_kernel(kernel: Kernel, data: &mut [u64], before: &[u64], w: usize, b: u32, nt: bool) {
+    let len = data.len();
+    // from bulk up, both source words are inside data.
+    let bulk = (w + 1).min(len);
+
+    // vector blocks cover [bottom, top), with scalar words on either side.
+    let (mut bottom, mut top) = (len, len);
+    let l = lanes(kernel);
+    if l != 0 {
+        let first = align_up(data, bulk, l);
+        let blocks = len.saturating_sub(first) / l;
+        if blocks != 0 {
+            bottom = first;
+            top = first + blocks * l;
+        }
+    }
+
+    let mut i = len;
+    while i > top {
+        i -= 1;
+        data[i] = funnel_right(data[i - w], data[i - w - 1], b);
+    }
+    if bottom < top {
+        unsafe {
+            vector_right(kernel, data.as_mut_ptr(), bottom, top, w, b, nt);
+        }
+        i = bottom;
+    }
+    while i > bulk {
+        i -= 1;
+        data[i] = funnel_right(data[i - w], data[i - w - 1], b);
+    }
+
+    let source = |data: &[u64], j: isize| -> u64 {
+        if j >= 0 {
+            data[j as usize]
+        } else if (-j) as usize <= before.len() {
+            before[(before.len() as isize + j) as usize]
+        } else {
+            0
+        }
+    };
+    while i > 0 {
+        i -= 1;
+        let j = i as isize - w as isize;
+        data[i] = funnel_right(source(data, j), source(data, j - 1), b);
+    }
+}
+
+// Left shift data in place by w words and b bits. after holds the words that
+// follow the end of data in the source, the first one adjacent; anything later
+// is 0. Works from the front up.
+fn left_kernel(kernel: Kernel, data: &mut [u64], after: &[u64], w: usize, b: u32, nt: bool) {
+    let len = data.len();
+    // below bulk, both source words are inside data.
+    let bulk = len.saturating_sub(w + 1);
+
+    let (mut bottom, mut top) = (0, 0);
+    let l = lanes(kernel);
+    if l != 0 {
+        let first = align_up(data, 0, l);
+        let blocks = bulk.saturating_sub(first) / l;
+        if blocks != 0 {
+            bottom = first;
+            top = first + blocks * l;
+        }
+    }
+
+    let mut i = 0;
+    while i < bottom {
+        data[i] = funnel_left(data[i + w], data[i + w + 1], b);
+        i += 1;
+    }
+    if bottom < top {
+        unsafe {
+            vector_left(kernel, data.as_mut_ptr(), bottom, top, w, b, nt);
+        }
+        i = top;
+    }
+    while i < bulk {
+        data[i] = funnel_left(data[i + w], data[i + w + 1], b);
+        i += 1;
+    }
+
+    let source = |data: &[u64], j: usize| -> u64 {
+        if j < len {
+            data[j]
+        } else if j - len < after.len() {
+            after[j - len]
+        } else {
+            0
+        }
+    };
+    while i < len {
+        data[i] = funnel_left(source(data, i + w), source(data, i + w + 1), b);
+        i += 1;
+    }
+}
+
+// Right shift the aligned blocks in [lo, hi) of p, from the top down. Every
+// source word, down to p[lo - w - 1], must be in bounds.
+unsafe fn vector_right(kernel: Kernel, p: *mut u64, lo: usize, hi: usize, w: usize, b: u32,
+                       nt: bool) {
+    match kernel {
+        #[cfg(target_arch = "x86_64")]
+        Kernel::Avx2 => simd::right_avx2(p, lo, hi, w, b, nt),
+        #[cfg(target_arch = "x86_64")]
+        Kernel::Avx512 => simd::right_avx512(p, lo, hi, w, b, nt),
+        _ => unreachable!()
+    }
+}
+
+// Left shift the aligned blocks in [lo, hi) of p, from the bottom up. Every
+// source word, up to p[hi + w], must be in bounds.
+unsafe fn vector_left(kernel: Kernel, p: *mut u64, lo: usize, hi: usize, w: usize, b: u32,
+                      nt: bool) {
+    match kernel {
+        #[cfg(target_arch = "x86_64")]
+        Kernel::Avx2 => simd::left_avx2(p, lo, hi, w, b, nt),
+        #[cfg(target_arch = "x86_64")]
+        Kernel::Avx512 => simd::left_avx512(p, lo, hi, w, b, nt),
+        _ => unreachable!()
+    }
+}
+
+/// Each vector is loaded twice from the source, once at the word that supplies
+/// its own bits and once one word over for the bits shifted in, then combined
+/// with a shift each way. Shift counts of 64 give zero, so b == 0 needs no
+/// special case. Both loads happen before the store, which keeps in place
+/// shifts safe as long as the loop runs away from the source.
+#[cfg(target_arch = "x86_64")]
+mod simd {
+    use std::arch::x86_64::*;
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn right_avx2(p: *mut u64, lo: usize, hi: usize, w: usize, b: u32, nt: bool) {
+        let own = _mm_cvtsi32_si128(b as i32);
+        let other = _mm_cvtsi32_si128(64 - b as i32);
+        let mut i = hi;
+        while i > lo {
+            i -= 4;
+            let hi_words = _mm256_loadu_si256(p.add(i - w) as *const __m256i);
+            let lo_words = _mm256_loadu_si256(p.add(i - w - 1) as *const __m256i);
+            let r = _mm256_or_si256(_mm256_srl_epi64(hi_words, own),
+                                    _mm256_sll_epi64(lo_words, other));
+            if nt {
+                _mm256_stream_si256(p.add(i) as *mut __m256i, r);
+            } else {
+                _mm256_store_si256(p.add(i) as *mut __m256i, r);
+            }
+        }
+        if nt {
+            _mm_sfence();
+        }
+    }
+
+    #[target_feature(enable = "avx2")]
+    pub unsafe fn left_avx2(p: *mut u64, lo: usize, hi: usize, w: usize, b: u32, nt: bool) {
+        let own = _mm_cvtsi32_si128(b as i32);
+        let other = _mm_cvtsi32_si128(64 - b as i32);
+        let mut i = lo;
+        while i < hi {
+            let lo_words = _mm256_loadu_si256(p.add(i + w) as *const __m256i);
+            let hi_words = _mm256_loadu_si256(p.add(i + w + 1) as *const __m256i);
+            let r = _mm256_or_si256(_mm256_sll_epi64(lo_words, own),
+                                    _mm256_srl_epi64(hi_words, other));
+            if nt {
+                _mm256_stream_si256(p.add(i) as *mut __m256i, r);
+            } else {
+                _mm256_store_si256(p.add(i) as *mut __m256i, r);
+            }
+            i += 4;
+        }
+        if nt {
+            _mm_sfence();
+        }
+    }
+
+    #[target_feature(enable = "avx512f")]
+    pub unsafe fn right_avx512(p: *mut u64, lo: usize, hi: usize, w: usize, b: u32, nt: bool) {
+        let own = _mm_cvtsi32_si128(b as i32);
+        let other = _mm_cvtsi32_si128(64 - b as i32);
+        let mut i = hi;
+        while i > lo {
+            i -= 8;
+            let hi_words = _mm512_loadu_si512(p.add(i - w) as *const __m512i);
+            let lo_words = _mm512_loadu_si512(p.add(i - w - 1) as *const __m512i);
+            let r = _mm512_or_si512(_mm512_srl_epi64(hi_words, own),
+                                    _mm512_sll_epi64(lo_words, other));
+            if nt {
+                _mm512_stream_si512(p.add(i) as *mut __m512i, r);
+            } else {
+                _mm512_store_si512(p.add(i) as *mut __m512i, r);
+            }
+        }
+        if nt {
+            _mm_sfence();
+        }
+    }
+
+    #[target_feature(enable = "avx512f")]
+    pub unsafe fn left_avx512(p: *mut u64, lo: usize, hi: usize, w: usize, b: u32, nt: bool) {
+        let own = _mm_cvtsi32_si128(b as i32);
+        let other = _mm_cvtsi32_si128(64 - b as i32);
+        let mut i = lo;
+        while i < hi {
+            let lo_words = _mm512_loadu_si512(p.add(i + w) as *const __m512i);
+            let hi_words = _mm512_loadu_si512(p.add(i + w + 1) as *const __m512i);
+            let r = _mm512_or_si512(_mm512_sll_epi64(lo_words, own),
+                                    _mm512_srl_epi64(hi_words, other));
+            if nt {
+                _mm512_stream_si512(p.add(i) as *mut __m512i, r);
+            } else {
+                _mm512_store_si512(p.add(i) as *mut __m512i, r);
+            }
+            i += 8;
+        }
+        if nt {
+            _mm_sfence();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{Kernel, Shifter, MIN_CHUNK};
+
+    fn random_words(n: usize, seed: u64) -> Vec<u64> {
+        let mut s = seed | 1;
+        (0..n).map(|_| {
+            s ^= s << 13;
+            s ^= s >> 7;
+            s ^= s << 17;
+            s
+        }).collect()
+    }
+
+    // One bit at a time, counting from the top bit of data[0].
+    fn reference(data: &[u64], shift: usize, right: bool) -> Vec<u64> {
+        let bits = data.len() * 64;
+        let bit = |k: usize| (data[k / 64] >> (63 - k % 64)) & 1;
+        let mut out = vec![0; data.len()];
+        for k in 0..bits {
+            let from = if right { k.checked_sub(shift) } else { k.checked_add(shift) };
+            if let Some(from) = from {
+                if from < bits {
+                    out[k / 64] |= bit(from) << (63 - k % 64);
+                }
+            }
+        }
+        out
+    }
+
+    fn kernels() -> Vec<Kernel> {
+        vec![Kernel::Scalar, Kernel::Avx2, Kernel::Avx512].into_iter()
+            .filter(|k| k.is_supported())
+            .collect()
+    }
+
+    #[test]
+    fn test_matches_reference() {
+        for &len in [0, 1, 2, 3, 7, 8, 9, 33, 100].iter() {
+            let data = random_words(len, len as u64);
+            for &shift in [0, 1, 7, 31, 63, 64, 65, 128, 200, (64 * len).saturating_sub(1), 64 * len,
+                           64 * len + 5].iter() {
+                for &right in [true, false].iter() {
+                    let expected = reference(&data, shift, right);
+                    for kernel in kernels() {
+                        for &nt in [0, usize::max_value()].iter() {
+                            let mut v = data.clone();
+                            let s = Shifter::new().kernel(kernel).non_temporal_above(nt);
+                            if right { s.right(&mut v, shift) } else { s.left(&mut v, shift) }
+                            assert_eq!(v, expected, "len {} shift {} right {} {:?} nt {}",
+                                       len, shift, right, kernel, nt);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_matches_shift_asm_example() {
+        let mut v = vec![0x10000000_00000001_u64; 1000];
+        super::shift_right(&mut v, 7);
+        assert_eq!(v[0], 0x00200000_00000000_u64);
+        assert_eq!(v[1], 0x02200000_00000000_u64);
+        assert_eq!(v[999], 0x02200000_00000000_u64);
+    }
+
+    #[test]
+    fn test_threads_carry_across_chunks() {
+        let len = MIN_CHUNK * 3 + 5;
+        let data = random_words(len, 99);
+        // small shifts use per chunk carries, large ones move words up front.
+        for &shift in [0, 3, 64, 64 * 1000 + 9, 64 * (MIN_CHUNK + 10) + 1].iter() {
+            for kernel in kernels() {
+                let single = Shifter::new().kernel(kernel);
+                for &threads in [2, 3, 4].iter() {
+                    let multi = single.threads(threads);
+                    let (mut a, mut b) = (data.clone(), data.clone());
+                    single.right(&mut a, shift);
+                    multi.right(&mut b, shift);
+                    assert!(a == b, "right shift {} {:?} threads {}", shift, kernel, threads);
+                    let (mut a, mut b) = (data.clone(), data.clone());
+                    single.left(&mut a, shift);
+                    multi.left(&mut b, shift);
+                    assert!(a == b, "left shift {} {:?} threads {}", shift, kernel, threads);
+                }
+            }
+        }
+        let mut v = data.clone();
+        Shifter::new().kernel(Kernel::Scalar).right(&mut v, 5);
+        assert_eq!(v, reference(&data, 5, true));
+    }
+}
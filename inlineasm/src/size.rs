@@ -0,0 +1,28 @@
+//! Byte sizes written with K, M or G suffixes, as sysfs and command lines
+//! give them.
+
+/// Parse a size like "48K" or "2m".
+pub fn parse_size(s: &str) -> Option<usize> {
+    let (digits, scale) = match s.chars().last() {
+        Some('K') | Some('k') => (&s[..s.len() - 1], 1 << 10),
+        Some('M') | Some('m') => (&s[..s.len() - 1], 1 << 20),
+        Some('G') | Some('g') => (&s[..s.len() - 1], 1 << 30),
+        _ => (s, 1)
+    };
+    digits.parse::<usize>().ok().map(|n| n * scale)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::parse_size;
+
+    #[test]
+    fn test_parse_size() {
+        assert_eq!(parse_size("48K"), Some(48 << 10));
+        assert_eq!(parse_size("2m"), Some(2 << 20));
+        assert_eq!(parse_size("1G"), Some(1 << 30));
+        assert_eq!(parse_size("4096"), Some(4096));
+        assert_eq!(parse_size("K"), None);
+        assert_eq!(parse_size("12x"), None);
+    }
+}